@@ -18,6 +18,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "internal.h"
@@ -30,57 +31,148 @@ static int BuildState = NOTSTARTED;
 
 /* these are the functions in use */
 double (*Func)(double, double, double);
+void (*FuncBatch)(double *, const double *, const double *, const double *, int);
 void (*NormalFunc)(double[3], double[3]);
 void (*ColorFunc)(double[3], double[3]);
 void (*TexCoordFunc)(double[3], double[3]);
+void (*GradientFunc)(double[3], double[3]);
+
+int RefineMethod = METEOR_REFINE_REGULA_FALSI, RefineIterations = 5;
+double RefineTolerance;
+long long RefineEdges, RefineEvaluations;
 
 /* stores the generated points (or null) for the slices of the meteor,
    A is the y-z plane, and B is just the y line in that plane */
-static struct point_t **TetraPointsA[2];
-static struct point_t **TetraPointsB[2];
-
-static mfloat *TetraPointValsB[2];
+static int *TetraPointsA[2];
+static int *TetraPointsB[2];
 
 static int TetraPointPageB; /* page in use */
 
+/* the function values for each y-z page of the slab currently being built,
+   page 0 holds the last page of the previous slab so the two connect */
+static mfloat **TetraPointValsB;
+
+/* the lattice coordinates along each axis, accumulated the same way the
+   cubes are walked so a block of points can be evaluated by itself */
+static mfloat *LatticeX, *LatticeY, *LatticeZ;
+
+/* number of pages built by each call to meteorBuild, when building with
+   threads the pages of a slab are sampled in parallel */
+static int SlabPages;
+#define SLAB_PAGES_PER_THREAD 4
+
+/* the points where the surface crosses the edges of each page in the slab,
+   calculated ahead of time (by the worker threads if there are any) in the
+   same order that tetrapage asks for them */
+struct edgelist {
+   int count, size, pos;
+   long long edgecount, evaluations; /* for meteorRefineIterations */
+   mfloat *data; /* position followed by extra data for each point */
+   mfloat (*edges)[2][4]; /* crossing edges in the row being solved */
+};
+
+static struct edgelist *EdgeLists;
+static struct edgelist *CurEdges; /* list MakePoint reads from */
+
+/* how the pages are turned into triangles, see meteorPolygonizer */
+static int Polygonizer = METEOR_TETRAHEDRA;
+
+/* the points on the x edges of a pair of pages, and on the y and z edges
+   in the pages at each end of it, CubePlane is the one at the high end */
+static int *CubeEdgesX, *CubeEdgesY[2], *CubeEdgesZ[2];
+static int CubePlane;
+static int CubePairs; /* pairs of pages done so far */
+
+/* surface nets keep just where the edges cross, and the point made
+   inside each cube of the last two pairs */
+static mfloat (*NetEdgesX)[3], (*NetEdgesY[2])[3], (*NetEdgesZ[2])[3];
+static int *NetPoints[2];
+
 static int UnsortedStart; /* index in heap of the first unsorted point */
 static unsigned int SortedPointCount; /* only used internally */
 
-struct point_t *NewPoint(void)
+int NewPoint(void)
 {
-   struct point_t *p = AllocPoint();
-   p->tris = NULL;
+   /* the new point is given where it goes after the transformations, so
+      they must not be left to move it again */
+   if(TransformPending)
+      ApplyTransform();
+
+   int p = AllocPoint();
+   PointCorner[p] = 0;
+   PointStream[p] = -1;
    heapInsertUnsorted(p);
    return p;
 }
 
-static struct tri_t *LastTri;
+int LastTri;
 
 /* add pairs to  p1, p2, and p3 so that this triangle exists */
-void NewTriangle(struct point_t *p1, struct point_t *p2, struct point_t *p3)
+void NewTriangle(int p1, int p2, int p3)
 {
 #ifdef DEBUG
    if(!p1 || !p2 || !p3)
       die("null points in triangle!\n");
 #endif
 
-   struct tri_t *Tri = AllocTri();
+   int tri = AllocTri(), c = 3*tri;
 
-   Tri->p[0] = p1;
-   Tri->p[1] = p2;
-   Tri->p[2] = p3;
+   Corners[c] = p1;
+   Corners[c+1] = p2;
+   Corners[c+2] = p3;
 
    if(heapMode == HEAP_MIN)
-      if(LastTri == Tris)
-         LastTri = Tri;
+      if(!LastTri)
+         LastTri = tri;
 
-   addToTriList(p1, Tri);
-   addToTriList(p2, Tri);
-   addToTriList(p3, Tri);
+   addCorner(c);
+   addCorner(c+1);
+   addCorner(c+2);
+}
+
+static void freeslab(void)
+{
+   int i;
+   if(TetraPointValsB)
+      for(i = 0; i <= SlabPages; i++)
+         free(TetraPointValsB[i]);
+   free(TetraPointValsB);
+   TetraPointValsB = NULL;
+
+   if(EdgeLists)
+      for(i = 0; i < SlabPages; i++) {
+         free(EdgeLists[i].data);
+         free(EdgeLists[i].edges);
+      }
+   free(EdgeLists);
+   EdgeLists = NULL;
+
+   free(LatticeX);
+   free(LatticeY);
+   free(LatticeZ);
+   LatticeX = LatticeY = LatticeZ = NULL;
+
+   free(CubeEdgesX);
+   free(NetEdgesX);
+   CubeEdgesX = NULL;
+   NetEdgesX = NULL;
+   for(i = 0; i < 2; i++) {
+      free(CubeEdgesY[i]);
+      free(CubeEdgesZ[i]);
+      free(NetEdgesY[i]);
+      free(NetEdgesZ[i]);
+      free(NetPoints[i]);
+      CubeEdgesY[i] = CubeEdgesZ[i] = NetPoints[i] = NULL;
+      NetEdgesY[i] = NetEdgesZ[i] = NULL;
+   }
+
+   SlabPages = 0;
 }
 
 void meteorFreeMem(void)
 {
+   progressiveFree();
+
    /* free regions allocated for building */
    free(TetraPointsA[0]);
    free(TetraPointsA[1]);
@@ -90,11 +182,9 @@ void meteorFreeMem(void)
    free(TetraPointsB[1]);
    TetraPointsB[0] = TetraPointsB[1] = NULL;
 
-   free(TetraPointValsB[0]);
-   free(TetraPointValsB[1]);
-   TetraPointValsB[0] = TetraPointValsB[1] = NULL;
+   freeslab();
 
-   /* free points triangles and triangle lists */
+   /* free points and triangles */
    freeMem();
    relinquishMem();
 
@@ -103,55 +193,100 @@ void meteorFreeMem(void)
    Heap = NULL;
 }
 
+/* calculate the extra data for a point at pos */
+static inline void CalculateData(mfloat pos[3], mfloat *data)
+{
+   /* calculate any additional data used by this point, with LazyData
+      this is put off until the data is read, since most points are
+      eliminated by merging before their data is ever used */
+#ifdef USE_DOUBLE_FORMAT
+   if(DataFormat & METEOR_NORMALS && NormalFunc)
+      NormalFunc(data + NormalOffset, pos);
+   if(DataFormat & METEOR_COLORS && ColorFunc)
+      ColorFunc(data + ColorOffset, pos);
+   if(DataFormat & METEOR_TEXCOORDS && TexCoordFunc)
+      TexCoordFunc(data + TexCoordOffset, pos);
+#else
+   double dpos[3] = {pos[0], pos[1], pos[2]}, ddata[3];
+#define SETDATA(x) (x)[0] = ddata[0], (x)[1] = ddata[1], (x)[2] = ddata[2]
+   if(DataFormat & METEOR_NORMALS && NormalFunc)
+      NormalFunc(ddata, dpos), SETDATA(data + NormalOffset);
+   if(DataFormat & METEOR_COLORS && ColorFunc)
+      ColorFunc(ddata, dpos), SETDATA(data + ColorOffset);
+   if(DataFormat & METEOR_TEXCOORDS && TexCoordFunc)
+      TexCoordFunc(ddata, dpos), SETDATA(data + TexCoordOffset);
+#undef SETDATA
+#endif
+}
+
+/* CalculateData for a point already made */
+void UpdatePointData(int p)
+{
+   mfloat pos[3], data[MAX_DATA];
+   loadpos(pos, p);
+   loaddata(data, p);
+   CalculateData(pos, data);
+   storedata(p, data);
+}
+
+/* LazyData puts off calling the data callbacks, DataStale is set
+   while there are points that have not had them called yet */
+int LazyData, DataStale;
+
+#define UPDATE_DATA_CHUNK 1024
+
+static void updatedataworker(int i, void *arg)
+{
+   int j, end = (i + 1) * UPDATE_DATA_CHUNK;
+   if(end > PointCount)
+      end = PointCount;
+   for(j = i * UPDATE_DATA_CHUNK; j < end; j++)
+      UpdatePointData(Heap[j]);
+}
+
+/* calculate the data from the callbacks for every point in one pass,
+   in parallel if there are threads */
+void UpdateData(void)
+{
+   DataStale = 0;
+   ParallelRun((PointCount + UPDATE_DATA_CHUNK - 1) / UPDATE_DATA_CHUNK,
+               updatedataworker, NULL);
+}
+
+void meteorLazyData(int lazy)
+{
+   LazyData = lazy;
+   if(!LazyData && DataStale)
+      UpdateData();
+}
+
 /* create a new point to be used by tris in the meteor, the position
-   should be interpolated between p1 and p2 (edge of tetrahedron) */
-static inline struct point_t *MakePoint(mfloat p1[4], mfloat p2[4])
+   should be interpolated between the ends of an edge with values v1 and v2 */
+static inline int MakePoint(mfloat v1, mfloat v2)
 {
-   /* if w1 and w2 have the same sign, they don't cut the surface */
-   if(p1[3] * p2[3] >= 0)
-      return NULL;
+   /* if v1 and v2 have the same sign, they don't cut the surface */
+   if(v1 * v2 >= 0)
+      return 0;
 
-   struct point_t *p = NewPoint();
+   int p = NewPoint();
 
    if(heapMode == HEAP_MIN) {
       int i;
       for(i = 0; i<10; i++)
-         p->Q[i] = 0;
+         PointQ[p].Q[i] = 0;
    }
 
-   mfloat q1[4] = {p1[0], p1[1], p1[2], p1[3]};
-   mfloat q2[4] = {p2[0], p2[1], p2[2], p2[3]};
-
-   iterativeimprove(p->pos, q1, q2, Func);
-
-   /* calculate any additional data used by this point,
-      this could be defered until later since it is possible
-      to eliminate this point with merging before this data is ever used */
-#ifdef USE_DOUBLE_FORMAT
-   if(DataFormat & METEOR_NORMALS)
-      NormalFunc(p->data + NormalOffset, p->pos);
-   if(DataFormat & METEOR_COLORS)
-      ColorFunc(p->data + ColorOffset, p->pos);
-   if(DataFormat & METEOR_TEXCOORDS)
-      TexCoordFunc(p->data + TexCoordOffset, p->pos);
-#else
-   double pos[3] = {p->pos[0], p->pos[1], p->pos[2]}, data[3];
-#define SETDATA(x) (x)[0] = data[0], (x)[1] = data[1], (x)[2] = data[2]
-   if(DataFormat & METEOR_NORMALS)
-      NormalFunc(data, pos), SETDATA(p->data + NormalOffset);
-   if(DataFormat & METEOR_COLORS)
-      ColorFunc(data, pos), SETDATA(p->data + ColorOffset);
-   if(DataFormat & METEOR_TEXCOORDS)
-      TexCoordFunc(data, pos), SETDATA(p->data + TexCoordOffset);
-#endif
+   /* the location was already calculated by edgepage */
+   mfloat *e = CurEdges->data + CurEdges->pos;
+   storepos(p, e);
+   storedata(p, e + 3);
+   CurEdges->pos += 3 + 3 * DataParts;
    return p;
 }
 
 /* take the 6 sides of a tetrahedron and also it's four points and
    add the appropriate triangles in the right orientation */
-static inline void addTetra(struct point_t *p1, struct point_t *p2,
-                            struct point_t *p3, struct point_t *p4,
-                            struct point_t *p5, struct point_t *p6,
+static inline void addTetra(int p1, int p2, int p3, int p4, int p5, int p6,
                             mfloat v1)
 {
    /* this jump table is used to calculate all 7 possible interesting
@@ -174,7 +309,7 @@ static inline void addTetra(struct point_t *p1, struct point_t *p2,
 
 /* uh.. the hideous expanded version of the above.. about 2x faster,
    see tetracalc.c for the code that generated this code */
-static inline void addCubeTetras(struct point_t **p, mfloat pv)
+static inline void addCubeTetras(int *p, mfloat pv)
 {
 #define T(a, b, c) if(pv<0) NewTriangle(p[a], p[b], p[c]); else NewTriangle(p[a], p[c], p[b]);
    switch((((((!p[4]*2+!p[2])*2+!p[1])*2+!p[8])*2+!p[14])*2+!p[15])*2+!p[18]) {
@@ -397,77 +532,144 @@ static inline void addCubeTetras(struct point_t **p, mfloat pv)
 static int xnum, ynum, znum, numA, numB;
 static mfloat xmin, ymin, zmin, step;
 
-/* there are two pages of tetrapoints that fill a y-z plane that
-   are alternated, this way the points on the surface can be connected
-   to the points below, this function fills a page with the values */
+/* optional bound on the function over a box, used to skip empty space */
+static void (*IntervalFunc)(double[2], double[3], double[3]);
+static double Lipschitz;
+
+/* distorts figure slightly but gets rid of 0 holes */
+#define ZERO_CLAMP .0001
 
-static void fillpage(mfloat x)
+/* evaluate the function at every lattice point of the block of the page
+   from y0 to y1 and z0 to z1, a z row (or FUNC_BATCH points of it) at a time */
+static void evalblock(mfloat *page, mfloat x, int y0, int y1, int z0, int z1)
 {
-   mfloat *page = TetraPointValsB[TetraPointPageB];
-   mfloat y, z;
-   int yi, zi;
-   for(y = ymin, yi = 0; yi < ynum - 1; y += step, yi++) {
-      mfloat zf1 = 0;
-      for(z = zmin + zf1, zi = 0; zi < znum - 1; z += step, zi++) {
-	 mfloat d = Func(x, y, z);
-
-	 /* distorts figure slightly but gets rid of 0 holes */
-         const mfloat c = .0001;
-	 if(fabs(d) < c)
-            d = c;
-	 *page++ = d;
+   double xs[FUNC_BATCH], ys[FUNC_BATCH], zs[FUNC_BATCH], vals[FUNC_BATCH];
+   int yi, zi, i;
+
+   for(i = 0; i < FUNC_BATCH; i++)
+      xs[i] = x;
+
+   for(yi = y0; yi < y1; yi++) {
+      mfloat *row = page + yi * (znum - 1);
+      for(i = 0; i < FUNC_BATCH; i++)
+         ys[i] = LatticeY[yi];
+
+      for(zi = z0; zi < z1;) {
+         int count;
+         for(count = 0; count < FUNC_BATCH && zi < z1; count++, zi++)
+            zs[count] = LatticeZ[zi];
+
+         FuncBatch(vals, xs, ys, zs, count);
+
+         for(i = 0; i < count; i++) {
+            mfloat d = vals[i];
+            if(fabs(d) < ZERO_CLAMP)
+               d = ZERO_CLAMP;
+            row[zi - count + i] = d;
+         }
       }
    }
+}
 
-   TetraPointPageB = !TetraPointPageB;
+/* smallest block worth bounding before evaluating it point by point */
+#define SKIP_BLOCK 16
+
+/* coarse to fine, if the bound shows the surface is nowhere near the block
+   every point in it gets the same sign without evaluating the function,
+   otherwise the block is split in two until it is small enough to evaluate */
+static void fillblock(mfloat *page, mfloat x, int y0, int y1, int z0, int z1)
+{
+   if(!IntervalFunc || (y1 - y0) * (z1 - z0) < SKIP_BLOCK) {
+      evalblock(page, x, y0, y1, z0, z1);
+      return;
+   }
+
+   /* the box reaches a step past the block on every side, so it holds every
+      point connected to the block by a tetrahedron edge, if they all have
+      the same sign as the block, no edge touching it crosses the surface
+      and the values themselves are never used */
+   double min[3] = {x - step, LatticeY[y0] - step, LatticeZ[z0] - step};
+   double max[3] = {x + step, LatticeY[y1-1] + step, LatticeZ[z1-1] + step};
+   double range[2];
+   IntervalFunc(range, min, max);
+
+   /* values near zero are clamped positive, so only skip well clear of it */
+   if(range[0] > ZERO_CLAMP || range[1] < -ZERO_CLAMP) {
+      mfloat d = range[0] > ZERO_CLAMP ? range[0] : range[1];
+      int yi, zi;
+      for(yi = y0; yi < y1; yi++)
+         for(zi = z0; zi < z1; zi++)
+            page[yi * (znum - 1) + zi] = d;
+      return;
+   }
+
+   if(y1 - y0 > z1 - z0) {
+      int ym = (y0 + y1) / 2;
+      fillblock(page, x, y0, ym, z0, z1);
+      fillblock(page, x, ym, y1, z0, z1);
+   } else {
+      int zm = (z0 + z1) / 2;
+      fillblock(page, x, y0, y1, z0, zm);
+      fillblock(page, x, y0, y1, zm, z1);
+   }
 }
 
+/* there are two pages of tetrapoints that fill a y-z plane that
+   are alternated, this way the points on the surface can be connected
+   to the points below, this function fills a page with the values */
+static void fillpage(mfloat *page, mfloat x)
+{
+   fillblock(page, x, 0, ynum - 1, 0, znum - 1);
+}
+
+/* the corners of the cube between the two pages, page1 is at x1 and
+   page2 at x2, the fourth value is the function value at the corner */
+#define CUBE_CORNERS {{x1, y1, z1+zf1, page1[0]}, \
+                      {x1, y1, z2+zf1, page1[1]}, \
+                      {x1, y2, z1+zf2, page1[znum-1]}, \
+                      {x1, y2, z2+zf2, page1[znum]}, \
+                      {x2, y1, z1+zf1, page2[0]}, \
+                      {x2, y1, z2+zf1, page2[1]}, \
+                      {x2, y2, z1+zf2, page2[znum-1]}, \
+                      {x2, y2, z2+zf2, page2[znum]}}
+
 /* this is the main marching tetrahedrons algorithm, it runs
    through the y-z plane at x, and generates tetrahedrons that fill
    the space between this plane, and the plane above. */
-static void tetrapage(mfloat x)
+static void tetrapage(mfloat x, mfloat *page1, mfloat *page2)
 {
-   struct point_t **ppB = TetraPointsB[TetraPointPageB];
-   struct point_t **opB = TetraPointsB[!TetraPointPageB];
+   int *ppB = TetraPointsB[TetraPointPageB];
+   int *opB = TetraPointsB[!TetraPointPageB];
    
    mfloat x1 = x - step, x2 = x;
    mfloat y1, y2, z1, z2;
    int yi, zi;
    int i1 = 0, i2 = znum - 1, i3 = i2 + numA;
 
-   mfloat *page1 = TetraPointValsB[TetraPointPageB];
-   mfloat *page2 = TetraPointValsB[!TetraPointPageB];
    int pageA = 0;
    for(y1 = ymin, y2 = ymin+step, yi = 1; yi < ynum-1; y1 += step, y2+=step, yi++) {
-      struct point_t **ppA = TetraPointsA[pageA];
-      struct point_t **opA = TetraPointsA[!pageA];
+      int *ppA = TetraPointsA[pageA];
+      int *opA = TetraPointsA[!pageA];
       int j = 0;
-      struct point_t *lastpoint = NULL, *curpoint;
+      int lastpoint = 0, curpoint;
       mfloat zf1 = 0, zf2 = 0;
       for(z1 = zmin, z2 = zmin+step, zi = 1; zi < znum-1; z1+=step, z2+=step, zi++) {
-         mfloat p[8][4] = {{x1, y1, z1+zf1, page1[0]},
-                           {x1, y1, z2+zf1, page1[1]},
-                           {x1, y2, z1+zf2, page1[znum-1]},
-                           {x1, y2, z2+zf2, page1[znum]},
-                           {x2, y1, z1+zf1, page2[0]},
-                           {x2, y1, z2+zf1, page2[1]},
-                           {x2, y2, z1+zf2, page2[znum-1]},
-                           {x2, y2, z2+zf2, page2[znum]}};
+         mfloat p[8][4] = CUBE_CORNERS;
          
-         struct point_t *cp[19] = {ppB[i1], ppB[i2], ppB[i2+1], ppB[i2+2],
-                                     ppB[i3], ppA[j], ppA[j+1], ppA[j+2],
-                                     lastpoint, opB[i1], opB[i2]};
+         int cp[19] = {ppB[i1], ppB[i2], ppB[i2+1], ppB[i2+2],
+                       ppB[i3], ppA[j], ppA[j+1], ppA[j+2],
+                       lastpoint, opB[i1], opB[i2]};
 
          cp[14] = opA[j];
 
          /* calculate the 7 unknowns */
-         opB[i2+1] = cp[11] = MakePoint(p[5], p[6]);
-         opB[i2+2] = cp[12] = MakePoint(p[5], p[7]);
-         opB[i3] = cp[13] = MakePoint(p[6], p[7]);
-         opA[j+1] = cp[15] = MakePoint(p[7], p[2]);
-         opA[j+2] = cp[16] = MakePoint(p[7], p[3]);
-         curpoint = cp[17] = MakePoint(p[5], p[3]);
-         struct point_t *c = cp[18] = MakePoint(p[2], p[5]);
+         opB[i2+1] = cp[11] = MakePoint(p[5][3], p[6][3]);
+         opB[i2+2] = cp[12] = MakePoint(p[5][3], p[7][3]);
+         opB[i3] = cp[13] = MakePoint(p[6][3], p[7][3]);
+         opA[j+1] = cp[15] = MakePoint(p[7][3], p[2][3]);
+         opA[j+2] = cp[16] = MakePoint(p[7][3], p[3][3]);
+         curpoint = cp[17] = MakePoint(p[5][3], p[3][3]);
+         int c = cp[18] = MakePoint(p[2][3], p[5][3]);
 
          /* every cube has 6 tetrahedrons */
          if(x1 != xmin && y1 != ymin && z1 != zmin) {
@@ -504,6 +706,497 @@ static void tetrapage(mfloat x)
       
       pageA = !pageA;
    }
+
+   /* the points made on this plane are used by the next page */
+   TetraPointPageB = !TetraPointPageB;
+}
+
+static inline void addedge(struct edgelist *e, int *n, mfloat p1[4], mfloat p2[4])
+{
+   if(p1[3] * p2[3] >= 0)
+      return;
+
+   memcpy(e->edges[*n][0], p1, sizeof e->edges[*n][0]);
+   memcpy(e->edges[*n][1], p2, sizeof e->edges[*n][1]);
+   (*n)++;
+}
+
+/* the same as iterativeimprove, but for count edges at once, so the function
+   is evaluated for a group of points with each call.  The positions are
+   written to pos, stride values apart */
+static int iterativeimprovebatch(mfloat *pos, int stride, mfloat (*q)[2][4],
+                                 int count, void func(double *, const double *,
+                                                      const double *,
+                                                      const double *, int),
+                                 void grad(double[3], double[3]))
+{
+   double x[FUNC_BATCH], y[FUNC_BATCH], z[FUNC_BATCH], v[FUNC_BATCH];
+   int active[FUNC_BATCH], last[FUNC_BATCH];
+   int i, j, k, a, evaluations = 0;
+   for(k = 0; k < count; k += FUNC_BATCH, pos += FUNC_BATCH * stride) {
+      int n = count - k < FUNC_BATCH ? count - k : FUNC_BATCH;
+      for(j = 0; j < n; j++) {
+         refinepoint(pos + j * stride, q[k+j][0], q[k+j][1]);
+         active[j] = j;
+         last[j] = 0;
+      }
+
+      /* edges drop out of the batch as they reach the tolerance */
+      for(i = 0; i < RefineIterations && n; i++) {
+         for(a = 0; a < n; a++) {
+            mfloat *p = pos + active[a] * stride;
+            x[a] = p[0], y[a] = p[1], z[a] = p[2];
+         }
+         func(v, x, y, z, n);
+         evaluations += n;
+
+         int remaining = 0;
+         for(a = 0; a < n; a++) {
+            j = active[a];
+            mfloat *p = pos + j * stride, *q1 = q[k+j][0], *q2 = q[k+j][1];
+            mfloat val = v[a];
+            if(fabs(val) <= RefineTolerance)
+               continue;
+
+            refineupdate(p, val, q1, q2, last + j);
+            if(!grad || !newtonstep(p, val, q1, q2, grad))
+               refinepoint(p, q1, q2);
+            active[remaining++] = j;
+         }
+         n = remaining;
+      }
+   }
+   return evaluations;
+}
+
+/* find the location on the surface of the n crossing edges found in a row,
+   they are improved together so the function is evaluated in batches */
+static void solverow(struct edgelist *e, int n)
+{
+   int i, size = 3 + 3 * DataParts;
+   if(e->count + n * size > e->size) {
+      e->size = 2 * (e->count + n * size);
+      e->data = realloc(e->data, e->size * sizeof *e->data);
+   }
+
+   mfloat *d = e->data + e->count;
+   e->evaluations += iterativeimprovebatch(d, size, e->edges, n, FuncBatch,
+                                           GradientFunc);
+   e->edgecount += n;
+   /* surface nets don't use these points for the mesh itself */
+   for(i = 0; i < n; i++)
+      if(!LazyData && Polygonizer != METEOR_SURFACE_NETS)
+         CalculateData(d + i * size, d + i * size + 3);
+
+   e->count += n * size;
+}
+
+/* calculate the points tetrapage will make for this page without touching
+   anything shared, this is where most of the time building is spent */
+static void edgepage(mfloat x, mfloat *page1, mfloat *page2, struct edgelist *e)
+{
+   mfloat x1 = x - step, x2 = x;
+   mfloat y1, y2, z1, z2;
+   int yi, zi;
+
+   e->count = e->pos = 0;
+   e->edgecount = e->evaluations = 0;
+   for(y1 = ymin, y2 = ymin+step, yi = 1; yi < ynum-1; y1 += step, y2+=step, yi++) {
+      mfloat zf1 = 0, zf2 = 0;
+      int n = 0;
+      for(z1 = zmin, z2 = zmin+step, zi = 1; zi < znum-1; z1+=step, z2+=step, zi++) {
+         mfloat p[8][4] = CUBE_CORNERS;
+
+         /* must be the same order as in tetrapage */
+         addedge(e, &n, p[5], p[6]);
+         addedge(e, &n, p[5], p[7]);
+         addedge(e, &n, p[6], p[7]);
+         addedge(e, &n, p[7], p[2]);
+         addedge(e, &n, p[7], p[3]);
+         addedge(e, &n, p[5], p[3]);
+         addedge(e, &n, p[2], p[5]);
+
+         page1++;
+         page2++;
+      }
+      solverow(e, n);
+      page1++;
+      page2++;
+   }
+}
+
+/* Marching cubes and surface nets use the same pages, but only the 12 edges
+   of each cube along the axes.  The edges along x between two pages are
+   solved with that pair, the edges along y and z in a page are solved with
+   the pair ending at it and kept until the next pair is done with them.
+   Like tetrapage, no triangles are made for cubes touching the low sides. */
+
+/* corner c of a cube is offset by (c>>2, c>>1&1, c&1), the edges are the
+   4 along x, then the 4 along y, then the 4 along z */
+static const int CubeEdgeCorners[12][2] = {{0, 4}, {1, 5}, {2, 6}, {3, 7},
+                                           {0, 2}, {1, 3}, {4, 6}, {5, 7},
+                                           {0, 1}, {2, 3}, {4, 5}, {6, 7}};
+
+/* the corners around each face, the faces are low x, high x, low y.. */
+static const int CubeFaces[6][4] = {{0, 1, 3, 2}, {4, 5, 7, 6}, {0, 1, 5, 4},
+                                    {2, 3, 7, 6}, {0, 2, 6, 4}, {1, 3, 7, 5}};
+
+/* the triangles for each combination of positive corners as edge indexes,
+   ended by -1, filled in by makecubetable */
+static signed char CubeTable[256][16];
+static int CubeTableReady;
+
+static int cubeedge(int a, int b)
+{
+   int i;
+   for(i = 0; i < 12; i++)
+      if((CubeEdgeCorners[i][0] == a && CubeEdgeCorners[i][1] == b) ||
+         (CubeEdgeCorners[i][0] == b && CubeEdgeCorners[i][1] == a))
+         break;
+   return i;
+}
+
+static void cubemidpoint(mfloat m[3], int e)
+{
+   int a = CubeEdgeCorners[e][0], b = CubeEdgeCorners[e][1];
+   m[0] = ((a >> 2) + (b >> 2)) / 2.0;
+   m[1] = ((a >> 1 & 1) + (b >> 1 & 1)) / 2.0;
+   m[2] = ((a & 1) + (b & 1)) / 2.0;
+}
+
+/* Rather than a table typed in, the cases are worked out from the faces.
+   On each face the crossing edges are joined around each run of positive
+   corners, so when a face has two positive corners across from each other
+   they are kept apart.  Since this only depends on the face, the cubes
+   on either side of it agree and the surface has no holes.  The pieces
+   are directed with the positive side on the left seen from outside the
+   cube, which joins them into loops that are split into fans of triangles
+   facing the positive side, the same way as the tetrahedrons face. */
+static void makecubetable(void)
+{
+   int m, f, i, j, k;
+   for(m = 0; m < 256; m++) {
+      int next[12];
+      for(i = 0; i < 12; i++)
+         next[i] = -1;
+
+      for(f = 0; f < 6; f++) {
+         const int *c = CubeFaces[f];
+         for(i = 0; i < 4; i++) {
+            int prev = c[(i + 3) % 4];
+            if(!(m >> c[i] & 1) || m >> prev & 1)
+               continue;
+
+            /* a run of positive corners starts at i and ends at j */
+            for(j = i; m >> c[(j + 1) % 4] & 1; j = (j + 1) % 4);
+            int a = cubeedge(prev, c[i]), b = cubeedge(c[j], c[(j + 1) % 4]);
+
+            mfloat ma[3], mb[3], u[3], v[3];
+            cubemidpoint(ma, a);
+            cubemidpoint(mb, b);
+            mfloat pc[3] = {c[i] >> 2, c[i] >> 1 & 1, c[i] & 1};
+            sub3(u, mb, ma);
+            sub3(v, pc, ma);
+
+            int axis = f / 2, a1 = (axis + 1) % 3, a2 = (axis + 2) % 3;
+            mfloat side = u[a1] * v[a2] - u[a2] * v[a1];
+            if((f & 1 ? side : -side) > 0)
+               next[a] = b;
+            else
+               next[b] = a;
+         }
+      }
+
+      int n = 0;
+      for(i = 0; i < 12; i++) {
+         if(next[i] < 0)
+            continue;
+
+         int loop[12], len = 0, e = i;
+         do {
+            loop[len++] = e;
+            int t = next[e];
+            next[e] = -1;
+            e = t;
+         } while(e != i);
+
+         for(k = 1; k + 1 < len; k++) {
+            CubeTable[m][n++] = loop[0];
+            CubeTable[m][n++] = loop[k];
+            CubeTable[m][n++] = loop[k + 1];
+         }
+      }
+      CubeTable[m][n] = -1;
+   }
+   CubeTableReady = 1;
+}
+
+/* calculate the points on the cube edges for this pair of pages, the
+   same as edgepage does for the tetrahedrons */
+static void cubeedgepage(mfloat x, mfloat *page1, mfloat *page2,
+                         struct edgelist *e)
+{
+   int rows = ynum - 1, cols = znum - 1;
+   mfloat x1 = x - step, x2 = x;
+   int yi, zi;
+
+   e->count = e->pos = 0;
+   e->edgecount = e->evaluations = 0;
+   for(yi = 0; yi < rows; yi++) {
+      int n = 0;
+      for(zi = 0; zi < cols; zi++) {
+         int i = yi * cols + zi;
+         mfloat a[4] = {x1, LatticeY[yi], LatticeZ[zi], page1[i]};
+         mfloat b[4] = {x2, LatticeY[yi], LatticeZ[zi], page2[i]};
+
+         /* must be the same order as in cubepage and netpage */
+         addedge(e, &n, a, b);
+         if(yi + 1 < rows) {
+            mfloat c[4] = {x2, LatticeY[yi+1], LatticeZ[zi], page2[i+cols]};
+            addedge(e, &n, b, c);
+         }
+         if(zi + 1 < cols) {
+            mfloat c[4] = {x2, LatticeY[yi], LatticeZ[zi+1], page2[i+1]};
+            addedge(e, &n, b, c);
+         }
+      }
+      solverow(e, n);
+   }
+}
+
+/* marching cubes between page1 and page2 */
+static void cubepage(mfloat x, mfloat *page1, mfloat *page2)
+{
+   int rows = ynum - 1, cols = znum - 1;
+   int *X = CubeEdgesX;
+   int *Y[2] = {CubeEdgesY[!CubePlane], CubeEdgesY[CubePlane]};
+   int *Z[2] = {CubeEdgesZ[!CubePlane], CubeEdgesZ[CubePlane]};
+   mfloat *page[2] = {page1, page2};
+   int yi, zi;
+
+   for(yi = 0; yi < rows; yi++)
+      for(zi = 0; zi < cols; zi++) {
+         int i = yi * cols + zi;
+         X[i] = MakePoint(page1[i], page2[i]);
+         Y[1][i] = yi + 1 < rows ? MakePoint(page2[i], page2[i+cols]) : 0;
+         Z[1][i] = zi + 1 < cols ? MakePoint(page2[i], page2[i+1]) : 0;
+      }
+
+   if(CubePairs++)
+      for(yi = 1; yi < rows - 1; yi++)
+         for(zi = 1; zi < cols - 1; zi++) {
+            int i = yi * cols + zi, c, index = 0;
+            for(c = 0; c < 8; c++)
+               if(page[c >> 2][i + (c >> 1 & 1) * cols + (c & 1)] > 0)
+                  index |= 1 << c;
+
+            const signed char *t = CubeTable[index];
+            if(*t < 0)
+               continue;
+
+            int p[12];
+            for(c = 0; c < 4; c++) {
+               int d1 = c >> 1, d2 = c & 1;
+               p[c] = X[i + d1 * cols + d2];
+               p[c+4] = Y[d1][i + d2];
+               p[c+8] = Z[d1][i + d2 * cols];
+            }
+
+            for(; *t >= 0; t += 3)
+               NewTriangle(p[t[0]], p[t[1]], p[t[2]]);
+         }
+
+   /* the points on the high page are used by the next pair */
+   CubePlane = !CubePlane;
+}
+
+/* copy the location where the surface crosses an edge */
+static inline void NetEdge(mfloat pos[3], mfloat v1, mfloat v2)
+{
+   if(v1 * v2 >= 0)
+      return;
+
+   memcpy(pos, CurEdges->data + CurEdges->pos, 3 * sizeof *pos);
+   CurEdges->pos += 3 + 3 * DataParts;
+}
+
+/* join the points in 4 cubes around an edge, splitting the
+   quad along the shorter diagonal */
+static inline void NetQuad(int a, int b, int c, int d, int flip)
+{
+   if(!a || !b || !c || !d)
+      return;
+
+   if(flip) {
+      int t = b;
+      b = d;
+      d = t;
+   }
+
+   mfloat pa[3], pb[3], pc[3], pd[3];
+   loadpos(pa, a), loadpos(pb, b), loadpos(pc, c), loadpos(pd, d);
+   if(dist2(pa, pc) <= dist2(pb, pd)) {
+      NewTriangle(a, b, c);
+      NewTriangle(a, c, d);
+   } else {
+      NewTriangle(b, c, d);
+      NewTriangle(b, d, a);
+   }
+}
+
+/* surface nets between page1 and page2, a point is made in each cube the
+   surface passes through at the average of where it crosses the edges,
+   then the points in the 4 cubes around each crossing edge are joined */
+static void netpage(mfloat x, mfloat *page1, mfloat *page2)
+{
+   int rows = ynum - 1, cols = znum - 1;
+   mfloat (*X)[3] = NetEdgesX;
+   mfloat (*Y[2])[3] = {NetEdgesY[!CubePlane], NetEdgesY[CubePlane]};
+   mfloat (*Z[2])[3] = {NetEdgesZ[!CubePlane], NetEdgesZ[CubePlane]};
+   int *P1 = NetPoints[!CubePlane], *P2 = NetPoints[CubePlane];
+   mfloat *page[2] = {page1, page2};
+   int yi, zi;
+
+   for(yi = 0; yi < rows; yi++)
+      for(zi = 0; zi < cols; zi++) {
+         int i = yi * cols + zi;
+         NetEdge(X[i], page1[i], page2[i]);
+         if(yi + 1 < rows)
+            NetEdge(Y[1][i], page2[i], page2[i+cols]);
+         if(zi + 1 < cols)
+            NetEdge(Z[1][i], page2[i], page2[i+1]);
+      }
+
+   memset(P2, 0, rows * cols * sizeof *P2);
+   if(!CubePairs++) {
+      CubePlane = !CubePlane;
+      return;
+   }
+
+   for(yi = 1; yi < rows - 1; yi++)
+      for(zi = 1; zi < cols - 1; zi++) {
+         int i = yi * cols + zi, c, e, count = 0;
+         mfloat v[8], pos[3] = {0, 0, 0};
+         for(c = 0; c < 8; c++)
+            v[c] = page[c >> 2][i + (c >> 1 & 1) * cols + (c & 1)];
+
+         for(e = 0; e < 12; e++) {
+            int a = CubeEdgeCorners[e][0], b = CubeEdgeCorners[e][1];
+            if(v[a] * v[b] >= 0)
+               continue;
+
+            int d1 = (e & 3) >> 1, d2 = e & 1;
+            mfloat *q;
+            if(e < 4)
+               q = X[i + d1 * cols + d2];
+            else if(e < 8)
+               q = Y[d1][i + d2];
+            else
+               q = Z[d1][i + d2 * cols];
+            add3(pos, q);
+            count++;
+         }
+
+         if(!count)
+            continue;
+
+         int p = P2[i] = NewPoint();
+         if(heapMode == HEAP_MIN)
+            for(c = 0; c<10; c++)
+               PointQ[p].Q[c] = 0;
+         for(e = 0; e < 3; e++)
+            pos[e] /= count;
+         storepos(p, pos);
+         if(!LazyData)
+            UpdatePointData(p);
+      }
+
+   /* the edges along x between the pages, and the edges along y and z
+      in page1 which have the cubes of the last pair on the other side */
+   for(yi = 1; yi < rows - 1; yi++)
+      for(zi = 1; zi < cols - 1; zi++) {
+         int i = yi * cols + zi;
+         if(page1[i] * page2[i] < 0)
+            NetQuad(P2[i-cols-1], P2[i-1], P2[i], P2[i-cols], page2[i] < 0);
+         if(page1[i] * page1[i+cols] < 0)
+            NetQuad(P1[i-1], P1[i], P2[i], P2[i-1], page1[i+cols] < 0);
+         if(page1[i] * page1[i+1] < 0)
+            NetQuad(P1[i-cols], P2[i-cols], P2[i], P1[i], page1[i+1] < 0);
+      }
+
+   CubePlane = !CubePlane;
+}
+
+/* work items for the threads, arg is the x location of each page */
+static void fillworker(int i, void *arg)
+{
+   mfloat *x = arg;
+   fillpage(TetraPointValsB[i+1], x[i]);
+}
+
+static void edgeworker(int i, void *arg)
+{
+   mfloat *x = arg;
+   if(Polygonizer == METEOR_TETRAHEDRA)
+      edgepage(x[i], TetraPointValsB[i], TetraPointValsB[i+1], EdgeLists + i);
+   else
+      cubeedgepage(x[i], TetraPointValsB[i], TetraPointValsB[i+1],
+                   EdgeLists + i);
+}
+
+static void alloclattice(void)
+{
+   LatticeX = malloc(xnum * sizeof *LatticeX);
+   LatticeY = malloc(ynum * sizeof *LatticeY);
+   LatticeZ = malloc(znum * sizeof *LatticeZ);
+
+   int i;
+   mfloat x, y, z;
+   for(x = xmin, i = 0; i < xnum; x += step, i++)
+      LatticeX[i] = x;
+   for(y = ymin, i = 0; i < ynum; y += step, i++)
+      LatticeY[i] = y;
+   for(z = zmin, i = 0; i < znum; z += step, i++)
+      LatticeZ[i] = z;
+}
+
+static void allocslab(void)
+{
+   int pages = ThreadCount > 1 ? ThreadCount * SLAB_PAGES_PER_THREAD : 1;
+
+   freeslab();
+   SlabPages = pages;
+
+   TetraPointValsB = malloc((SlabPages + 1) * sizeof *TetraPointValsB);
+   int i;
+   for(i = 0; i <= SlabPages; i++)
+      TetraPointValsB[i] = malloc(ynum * znum * sizeof **TetraPointValsB);
+
+   EdgeLists = calloc(SlabPages, sizeof *EdgeLists);
+   for(i = 0; i < SlabPages; i++)
+      EdgeLists[i].edges = malloc(7 * znum * sizeof *EdgeLists[i].edges);
+
+   alloclattice();
+
+   /* the cube edges and points, one for each lattice point in a page */
+   int size = (ynum - 1) * (znum - 1);
+   if(Polygonizer == METEOR_MARCHING_CUBES) {
+      CubeEdgesX = malloc(size * sizeof *CubeEdgesX);
+      for(i = 0; i < 2; i++) {
+         CubeEdgesY[i] = malloc(size * sizeof *CubeEdgesY[i]);
+         CubeEdgesZ[i] = malloc(size * sizeof *CubeEdgesZ[i]);
+      }
+      if(!CubeTableReady)
+         makecubetable();
+   } else if(Polygonizer == METEOR_SURFACE_NETS) {
+      NetEdgesX = malloc(size * sizeof *NetEdgesX);
+      for(i = 0; i < 2; i++) {
+         NetEdgesY[i] = malloc(size * sizeof *NetEdgesY[i]);
+         NetEdgesZ[i] = malloc(size * sizeof *NetEdgesZ[i]);
+         NetPoints[i] = malloc(size * sizeof *NetPoints[i]);
+      }
+   }
+   CubePlane = CubePairs = 0;
 }
 
 void meteorSetSize(double xmin1, double xmax1, double ymin1, double ymax1,
@@ -522,16 +1215,14 @@ void meteorSetSize(double xmin1, double xmax1, double ymin1, double ymax1,
    numA = 2 * znum - 1;
    numB = ynum * (znum + numA - 1) - znum + 1;
 
-   /* assuming memset 0 can be used to make all null pointers */
+   /* point 0 is never used, so clearing to 0 means no points */
    TetraPointsA[0] = realloc(TetraPointsA[0], sizeof(*TetraPointsA[0]) * numA);
    memset(TetraPointsA[0], 0, sizeof(*TetraPointsA[0]) * numA);
    TetraPointsA[1] = realloc(TetraPointsA[1], sizeof(*TetraPointsA[1]) * numA);
    memset(TetraPointsA[1], 0, sizeof(*TetraPointsA[1]) * numA);
 
-   TetraPointValsB[0] = realloc(TetraPointValsB[0],
-                                sizeof(*TetraPointValsB[0]) * ynum * znum);
-   TetraPointValsB[1] = realloc(TetraPointValsB[1],
-                                sizeof(*TetraPointValsB[1]) * ynum * znum);
+   /* the value pages depend on the size, allocated when building starts */
+   freeslab();
    TetraPointPageB = 0;
 
    TetraPointsB[0] = realloc(TetraPointsB[0], sizeof(*TetraPointsB[0]) * numB);
@@ -540,49 +1231,73 @@ void meteorSetSize(double xmin1, double xmax1, double ymin1, double ymax1,
    memset(TetraPointsB[1], 0, sizeof(*TetraPointsB[1]) * numB);
 }
 
-/* update points Q matrix to contain triangle offsets */
-void AddQTri(struct tri_t *tri)
+/* the quadric of distance squared to the plane of a triangle */
+void TriQuadric(int tri, mfloat q[10])
 {
-   struct point_t *p1 = tri->p[0], *p2 = tri->p[1], *p3 = tri->p[2];
-   mfloat n[4], v[2][3], q[10];
-   sub3(v[0], p2->pos, p1->pos);
-   sub3(v[1], p3->pos, p1->pos);
+   int p1 = Corners[3*tri], p2 = Corners[3*tri+1], p3 = Corners[3*tri+2];
+   mfloat n[4], v[2][3], pos[3][3];
+   loadpos(pos[0], p1), loadpos(pos[1], p2), loadpos(pos[2], p3);
+   sub3(v[0], pos[1], pos[0]);
+   sub3(v[1], pos[2], pos[0]);
    cross(n, v[0], v[1]);
       
    normalize(n);  /* changes results a bit if we don't do it */
    
-   n[3] = -dot(n, p1->pos);
+   n[3] = -dot(n, pos[0]);
    
    q[0]  = n[0]*n[0], q[1]  = n[0]*n[1], q[2] = n[0]*n[2], q[3] = n[0]*n[3];
                       q[4]  = n[1]*n[1], q[5] = n[1]*n[2], q[6] = n[1]*n[3];
                                          q[7] = n[2]*n[2], q[8] = n[2]*n[3];
                                                            q[9] = n[3]*n[3];
+}
+
+/* update points Q matrix to contain triangle offsets */
+void AddQTri(int tri)
+{
+   int p1 = Corners[3*tri], p2 = Corners[3*tri+1], p3 = Corners[3*tri+2];
+   mfloat q[10];
+   TriQuadric(tri, q);
 
-   add4x4tri(p1->Q, q);
-   add4x4tri(p2->Q, q);
-   add4x4tri(p3->Q, q);
+   add4x4tri(PointQ[p1].Q, q);
+   add4x4tri(PointQ[p2].Q, q);
+   add4x4tri(PointQ[p3].Q, q);
 }
 
-/* take all unsorted points and put them in a heap */
+/* take all unsorted points and put them in the heap, each linked to the
+   cheapest merge with the points already sorted, see QuadricPoint */
 void buildQHeap(void)
 {
+   if(TransformPending)
+      ApplyTransform();
+
    int i, j;
    if(heapMode != HEAP_MIN) {
       /* was not in heap mode, calculate Q matrix for existing points
          this gets calculated as future points are created */
       for(i = 0; i<PointCount; i++)
          for(j = 0; j<10; j++)
-            Heap[i]->Q[j] = 0;
+            PointQ[Heap[i]].Q[j] = 0;
 
-      struct tri_t *tri;
-      for(tri = Tris->next; tri != Tris; tri = tri->next)
+      int tri;
+      for(tri = TriNext[0]; tri; tri = TriNext[tri])
          AddQTri(tri);
 
       heapMode = HEAP_MIN;
 
       if(BuildState == NOTSTARTED) {
+         /* sort every point again, the mesh may have changed since */
+         heapSize = UnsortedStart = 0;
          SortedPointCount = PointCount;
          SortedTriangleCount = TriangleCount;
+      } else {
+         /* the points already in the heap were put there by aggregation */
+         int sorted = heapSize;
+         heapSize = 0;
+         for(i = 0; i < sorted; i++) {
+            int p = Heap[i];
+            QuadricPoint(p, 0);
+            heapInsert(p);
+         }
       }
    } else
       if(BuildState == NOTSTARTED)
@@ -594,11 +1309,10 @@ void buildQHeap(void)
 
    int UnsortedStop = SortedPointCount - heapSize + UnsortedStart;
    while(UnsortedStart < UnsortedStop) {
-      struct point_t *p = Heap[UnsortedStart];
-      if(p->tris) {
-         CalculateOptimalPoint(p, 1);
-         if(BuildState == NOSYNC) /* discourage this merge */
-            p->cost++;
+      int p = Heap[UnsortedStart];
+      if(PointCorner[p]) {
+         /* discourage merges with points that may get more triangles */
+         QuadricPoint(p, BuildState == NOSYNC);
          heapInsert(p);
       } else
          FreePoint(p);
@@ -613,12 +1327,355 @@ static void UnsortedRemoveNoTris(void)
    /* get rid of any points without triangles, and stuff rest in heap */
    int i;
    for(i = 0; i<PointCount; i++) {
-      struct point_t *p = Heap[i];
-      if(!p->tris) {
+      int p = Heap[i];
+      if(!PointCorner[p]) {
          FreePoint(p);
          Heap[i] = Heap[PointCount];
-         Heap[i]->index = i;
+         PointIndex[Heap[i]] = i;
+      }
+   }
+}
+
+/* With a sink set, the points and triangles the sweep has moved past are
+   handed to it and freed while building, so only those near the pages
+   being built are kept, and the memory used depends on the size of the
+   y-z plane rather than the whole surface. */
+static void (*StreamSink)(const double *, int, const int *, int);
+static int StreamPoints; /* points sent so far this build */
+
+/* send the first finished points in the heap (which can't get any more
+   triangles) and every triangle whose points have all been sent, then
+   free what isn't needed anymore */
+static void flushstream(int finished)
+{
+   int i, j, size = 3 + 3 * DataParts;
+   int pointcount = 0, trianglecount = 0;
+   double *points = malloc(finished * size * sizeof *points), *d = points;
+
+   for(i = 0; i < finished; i++) {
+      int p = Heap[i];
+      if(PointStream[p] >= 0 || !PointCorner[p])
+         continue;
+
+      if(DataStale)
+         UpdatePointData(p);
+      mfloat pos[3], data[MAX_DATA];
+      loadpos(pos, p);
+      loaddata(data, p);
+      for(j = 0; j < 3; j++)
+         *d++ = pos[j];
+      for(j = 0; j < 3 * DataParts; j++)
+         *d++ = data[j];
+      PointStream[p] = StreamPoints + pointcount++;
+   }
+
+   int *triangles = NULL, size2 = 0;
+   int tri, next;
+   for(tri = TriNext[0]; tri; tri = next) {
+      int *tp = Corners + 3*tri;
+      next = TriNext[tri];
+      if(PointStream[tp[0]] < 0 || PointStream[tp[1]] < 0
+         || PointStream[tp[2]] < 0)
+         continue;
+
+      if(3 * (trianglecount + 1) > size2) {
+         size2 = 2 * size2 + 3 * 1024;
+         triangles = realloc(triangles, size2 * sizeof *triangles);
+      }
+      for(j = 0; j < 3; j++) {
+         triangles[3 * trianglecount + j] = PointStream[tp[j]];
+         removeCorner(3*tri + j);
       }
+      trianglecount++;
+      FreeTri(tri);
+   }
+
+   StreamPoints += pointcount;
+   if(pointcount || trianglecount)
+      StreamSink(points, pointcount, triangles, trianglecount);
+   free(points);
+   free(triangles);
+
+   /* points left without triangles are done with, keep the rest in order */
+   int count = PointCount;
+   for(i = j = 0; i < count; i++) {
+      int p = Heap[i];
+      if(i < finished && !PointCorner[p])
+         FreePoint(p);
+      else {
+         Heap[j] = p;
+         PointIndex[p] = j++;
+      }
+   }
+}
+
+/* Rather than scanning the whole range, the surface can be followed from
+   seed points.  Starting from a cube the surface crosses, only neighboring
+   cubes the surface continues into are visited, so the function values, the
+   points on the edges and the visited cubes are kept in hash tables instead
+   of pages, and both the time and memory needed depend on the area of the
+   surface instead of the volume of the range.  The cubes are split into the
+   same 6 tetrahedrons as tetrapage uses, so the mesh is the same. */
+
+static double *Seeds;
+static int SeedCount;
+
+static struct hashtable CellVals, CellEdges, CellsVisited;
+
+/* cubes waiting to be visited */
+static int (*CellStack)[3];
+static int CellStackSize, CellStackCount;
+
+/* corner c of a cube is offset by (c>>2, c>>1&1, c&1), the 6 tetrahedrons
+   share the diagonal from corner 2 to corner 5 */
+static const int CellTetras[6][4] = {{2, 6, 4, 5}, {2, 6, 7, 5}, {2, 0, 4, 5},
+                                     {2, 0, 1, 5}, {2, 3, 7, 5}, {2, 3, 1, 5}};
+
+static inline long long latticeindex(int i, int j, int k)
+{
+   return ((long long)i * ynum + j) * znum + k;
+}
+
+/* cubes with triangles are the same as the ones tetrapage makes them for */
+static inline int cellinrange(int i, int j, int k)
+{
+   return i >= 1 && i <= xnum - 2 && j >= 1 && j <= ynum - 3
+      && k >= 1 && k <= znum - 3;
+}
+
+static mfloat cellvalue(int i, int j, int k)
+{
+   int found;
+   union hashitem *item = hashInsert(&CellVals, latticeindex(i, j, k), &found);
+   if(!found) {
+      mfloat d = Func(LatticeX[i], LatticeY[j], LatticeZ[k]);
+      if(fabs(d) < ZERO_CLAMP)
+         d = ZERO_CLAMP;
+      item->val = d;
+   }
+   return item->val;
+}
+
+/* fill in the location and value of the corners of a cube */
+static void cellcorners(mfloat c[8][4], int i, int j, int k)
+{
+   int n;
+   for(n = 0; n < 8; n++) {
+      int ci = i + (n >> 2), cj = j + (n >> 1 & 1), ck = k + (n & 1);
+      c[n][0] = LatticeX[ci];
+      c[n][1] = LatticeY[cj];
+      c[n][2] = LatticeZ[ck];
+      c[n][3] = cellvalue(ci, cj, ck);
+   }
+}
+
+/* a mix of signs among the corners n of the cube */
+static int cellcrosses(mfloat c[8][4], const int *n, int count)
+{
+   int i;
+   for(i = 1; i < count; i++)
+      if(c[n[0]][3] * c[n[i]][3] < 0)
+         return 1;
+   return 0;
+}
+
+/* the point where the surface crosses the edge between corners a and b
+   of cube (i, j, k), made the first time any cube asks for it */
+static int cellpoint(mfloat c[8][4], int i, int j, int k, int a, int b)
+{
+   /* key on the lower lattice index and the direction to the other end */
+   long long la = latticeindex(i + (a >> 2), j + (a >> 1 & 1), k + (a & 1));
+   long long lb = latticeindex(i + (b >> 2), j + (b >> 1 & 1), k + (b & 1));
+   if(la > lb) {
+      int t = a; a = b; b = t;
+      long long l = la; la = lb; lb = l;
+   }
+   int dir = ((b >> 2) - (a >> 2) + 1) * 9 + ((b >> 1 & 1) - (a >> 1 & 1) + 1) * 3
+      + (b & 1) - (a & 1) + 1;
+
+   int found;
+   union hashitem *item = hashInsert(&CellEdges, la * 32 + dir, &found);
+   if(found)
+      return item->point;
+
+   int p = NewPoint();
+   if(heapMode == HEAP_MIN) {
+      int n;
+      for(n = 0; n<10; n++)
+         PointQ[p].Q[n] = 0;
+   }
+
+   mfloat q1[4], q2[4], pos[3];
+   memcpy(q1, c[a], sizeof q1);
+   memcpy(q2, c[b], sizeof q2);
+   RefineEvaluations += iterativeimprove(pos, q1, q2, Func, GradientFunc);
+   RefineEdges++;
+   storepos(p, pos);
+   if(!LazyData)
+      UpdatePointData(p);
+
+   item->point = p;
+   return p;
+}
+
+/* add a triangle on the edges e of the cube, facing away from corner n which
+   is on the negative side.  The orientation is worked out from the middle of
+   the edges so it doesn't depend on where along them the points ended up */
+static void celltriangle(mfloat c[8][4], int i, int j, int k,
+                         const int e[3][2], int n)
+{
+   mfloat m[3][3], v[2][3], cr[3], d[3];
+   int t;
+   for(t = 0; t < 3; t++)
+      avg3(m[t], c[e[t][0]], c[e[t][1]]);
+   sub3(v[0], m[1], m[0]);
+   sub3(v[1], m[2], m[0]);
+   cross(cr, v[0], v[1]);
+   sub3(d, c[n], m[0]);
+
+   int p[3];
+   for(t = 0; t < 3; t++)
+      p[t] = cellpoint(c, i, j, k, e[t][0], e[t][1]);
+
+   if(dot(cr, d) < 0)
+      NewTriangle(p[0], p[1], p[2]);
+   else
+      NewTriangle(p[0], p[2], p[1]);
+}
+
+/* marching tetrahedrons for one of the tetrahedrons of a cube */
+static void celltetra(mfloat c[8][4], int i, int j, int k, const int v[4])
+{
+   int pos[4], neg[4], np = 0, nn = 0, t;
+   for(t = 0; t < 4; t++)
+      if(c[v[t]][3] > 0)
+         pos[np++] = v[t];
+      else
+         neg[nn++] = v[t];
+
+   if(np == 1) {
+      const int e[3][2] = {{pos[0], neg[0]}, {pos[0], neg[1]}, {pos[0], neg[2]}};
+      celltriangle(c, i, j, k, e, neg[0]);
+   } else if(np == 3) {
+      const int e[3][2] = {{neg[0], pos[0]}, {neg[0], pos[1]}, {neg[0], pos[2]}};
+      celltriangle(c, i, j, k, e, neg[0]);
+   } else if(np == 2) {
+      /* the quad between the two pairs, split in two */
+      const int e1[3][2] = {{pos[0], neg[0]}, {pos[0], neg[1]}, {pos[1], neg[1]}};
+      const int e2[3][2] = {{pos[0], neg[0]}, {pos[1], neg[1]}, {pos[1], neg[0]}};
+      celltriangle(c, i, j, k, e1, neg[0]);
+      celltriangle(c, i, j, k, e2, neg[0]);
+   }
+}
+
+static void pushcell(int i, int j, int k)
+{
+   int found;
+   if(!cellinrange(i, j, k))
+      return;
+   hashInsert(&CellsVisited, latticeindex(i, j, k), &found);
+   if(found)
+      return;
+
+   if(CellStackCount == CellStackSize) {
+      CellStackSize = CellStackSize ? 2 * CellStackSize : 1024;
+      CellStack = realloc(CellStack, CellStackSize * sizeof *CellStack);
+   }
+   CellStack[CellStackCount][0] = i;
+   CellStack[CellStackCount][1] = j;
+   CellStack[CellStackCount][2] = k;
+   CellStackCount++;
+}
+
+/* find a cube the surface crosses starting from the seed, if the cube
+   holding it doesn't, look along each axis for the nearest one that does */
+static void seedcell(double seed[3])
+{
+   static const int all[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+   double d[3] = {floor((seed[0] - xmin) / step),
+                  floor((seed[1] - ymin) / step),
+                  floor((seed[2] - zmin) / step)};
+   mfloat c[8][4];
+
+   /* check while still a double, a seed far outside won't fit in an int
+      (this is false for NaN too) */
+   if(!(d[0] >= 1 && d[0] <= xnum - 2 && d[1] >= 1 && d[1] <= ynum - 3
+        && d[2] >= 1 && d[2] <= znum - 3))
+      return;
+   int s[3] = {d[0], d[1], d[2]};
+
+   int dist, axis, dir;
+   for(dist = 0;; dist++) {
+      int searched = 0;
+      for(axis = 0; axis < 3; axis++)
+         for(dir = -1; dir <= 1; dir += 2) {
+            int n[3] = {s[0], s[1], s[2]};
+            n[axis] += dir * dist;
+            if(!cellinrange(n[0], n[1], n[2]))
+               continue;
+            searched = 1;
+            cellcorners(c, n[0], n[1], n[2]);
+            if(cellcrosses(c, all, 8)) {
+               pushcell(n[0], n[1], n[2]);
+               return;
+            }
+         }
+      if(!searched)
+         return; /* this seed is nowhere near the surface */
+   }
+}
+
+static void followsurface(void)
+{
+   /* the faces of a cube by their corners, and the neighbor across each */
+   static const int faces[6][4] = {{0, 1, 2, 3}, {4, 5, 6, 7}, {0, 1, 4, 5},
+                                   {2, 3, 6, 7}, {0, 2, 4, 6}, {1, 3, 5, 7}};
+   static const int neighbors[6][3] = {{-1, 0, 0}, {1, 0, 0}, {0, -1, 0},
+                                       {0, 1, 0}, {0, 0, -1}, {0, 0, 1}};
+   int n;
+
+   /* a scan build may have been left part way with its own lattice */
+   freeslab();
+   alloclattice();
+   for(n = 0; n < SeedCount; n++)
+      seedcell(Seeds + 3*n);
+
+   while(CellStackCount) {
+      CellStackCount--;
+      int i = CellStack[CellStackCount][0], j = CellStack[CellStackCount][1];
+      int k = CellStack[CellStackCount][2];
+      mfloat c[8][4];
+      cellcorners(c, i, j, k);
+
+      for(n = 0; n < 6; n++)
+         celltetra(c, i, j, k, CellTetras[n]);
+
+      /* the surface continues into the neighbors across faces it crosses */
+      for(n = 0; n < 6; n++)
+         if(cellcrosses(c, faces[n], 4))
+            pushcell(i + neighbors[n][0], j + neighbors[n][1],
+                     k + neighbors[n][2]);
+   }
+
+   hashFree(&CellVals);
+   hashFree(&CellEdges);
+   hashFree(&CellsVisited);
+   free(CellStack);
+   CellStack = NULL;
+   CellStackSize = 0;
+   freeslab();
+}
+
+void meteorSeeds(double *points, int count)
+{
+   free(Seeds);
+   Seeds = NULL;
+   SeedCount = 0;
+
+   if(count > 0) {
+      Seeds = malloc(3 * count * sizeof *Seeds);
+      memcpy(Seeds, points, 3 * count * sizeof *Seeds);
+      SeedCount = count;
    }
 }
 
@@ -627,17 +1684,54 @@ int meteorBuild(void)
    static int xi;
    static mfloat x;
 
+   if(TransformPending)
+      ApplyTransform();
+
+   if(LazyData && DataFormat != METEOR_COORDS)
+      DataStale = 1;
+
+   if(SeedCount) {
+      /* follow the surface in one go */
+      freeMem();
+      RefineEdges = RefineEvaluations = 0;
+      UnsortedStart = 0;
+      LastTri = 0;
+      BuildState = NOSYNC;
+
+      followsurface();
+
+      int tri;
+      for(tri = LastTri; tri; tri = TriNext[tri])
+         AddQTri(tri);
+      LastTri = 0;
+
+      SortedPointCount = PointCount;
+      SortedTriangleCount = TriangleCount;
+      if(heapMode == HEAP_MIN)
+         buildQHeap();
+      else if(StreamSink) {
+         StreamPoints = 0;
+         flushstream(PointCount);
+      }
+      BuildState = NOTSTARTED;
+      MeshModified = 1;
+      return 0;
+   }
+
    if(BuildState == NOTSTARTED) {
       /* just started building */
       freeMem();
+      allocslab();
       TetraPointPageB = 0;
-      fillpage(xmin);
+      fillpage(TetraPointValsB[0], xmin);
+      RefineEdges = RefineEvaluations = 0;
 
       xi = 0;
       UnsortedStart = 0;
+      StreamPoints = 0;
       x = xmin + step;
 
-      LastTri = Tris;
+      LastTri = 0;
    }
 
    SortedPointCount = PointCount;
@@ -651,21 +1745,55 @@ int meteorBuild(void)
       int end = PointCount - heapSize + UnsortedStart;
       for(i = UnsortedStart, j = heapSize; i<end; i++, j++) {
          Heap[j] = Heap[i];
-         Heap[j]->index = j;
+         PointIndex[Heap[j]] = j;
       }
       UnsortedStart = heapSize;
    }
 
-   struct tri_t *tri;
-   for(tri = LastTri; tri != Tris; tri = tri->next)
+   int tri;
+   for(tri = LastTri; tri; tri = TriNext[tri])
       AddQTri(tri);
-   LastTri = Tris;
+   LastTri = 0;
+
+   int i, pages = xnum - 1 - xi;
+   if(pages > SlabPages)
+      pages = SlabPages;
+   if(pages < 1)
+      pages = 1;
+
+   mfloat xs[pages];
+   for(i = 0; i < pages; i++, x += step)
+      xs[i] = x;
+
+   /* sample each page of the slab and find where the surface crosses (in
+      parallel if there are threads), then connect everything up in order
+      so the result is the same no matter how many threads were used */
+   ParallelRun(pages, fillworker, xs);
+   ParallelRun(pages, edgeworker, xs);
+
+   for(i = 0; i < pages; i++) {
+      CurEdges = EdgeLists + i;
+      switch(Polygonizer) {
+      case METEOR_TETRAHEDRA:
+         tetrapage(xs[i], TetraPointValsB[i], TetraPointValsB[i+1]);
+         break;
+      case METEOR_MARCHING_CUBES:
+         cubepage(xs[i], TetraPointValsB[i], TetraPointValsB[i+1]);
+         break;
+      case METEOR_SURFACE_NETS:
+         netpage(xs[i], TetraPointValsB[i], TetraPointValsB[i+1]);
+         break;
+      }
+      RefineEdges += CurEdges->edgecount;
+      RefineEvaluations += CurEdges->evaluations;
+   }
 
-   fillpage(x);
-   tetrapage(x);
+   /* the last page sampled starts the next slab */
+   mfloat *last = TetraPointValsB[pages];
+   TetraPointValsB[pages] = TetraPointValsB[0];
+   TetraPointValsB[0] = last;
 
-   x += step;
-   xi++;
+   xi += pages;
 
    if(xi >= xnum - 1) {
       /* finished building */
@@ -674,19 +1802,107 @@ int meteorBuild(void)
          SortedTriangleCount = TriangleCount;
          /* once finished building, the heap has to be contiguous */
          buildQHeap();
-      } else
+      } else if(StreamSink)
+         flushstream(PointCount);
+      else
          UnsortedRemoveNoTris();
       BuildState = NOTSTARTED;
-   }
+   } else if(StreamSink && heapMode != HEAP_MIN)
+      /* the points from before this slab have all their triangles now */
+      flushstream(SortedPointCount);
 
    MeshModified = 1;
 
-   return xnum - 1 - xi;
+   return (xnum - 1 - xi + SlabPages - 1) / SlabPages;
+}
+
+/* adapters so a scalar function can be evaluated in batches,
+   and a batch function can be evaluated for a single point */
+static void funcbatchadapter(double *vals, const double *x, const double *y,
+                             const double *z, int count)
+{
+   int i;
+   for(i = 0; i < count; i++)
+      vals[i] = Func(x[i], y[i], z[i]);
+}
+
+static double funcadapter(double x, double y, double z)
+{
+   double val;
+   FuncBatch(&val, &x, &y, &z, 1);
+   return val;
 }
 
 void meteorFunc(double (*func)(double x, double y, double z))
 {
    Func = func;
+   FuncBatch = func ? funcbatchadapter : NULL;
+}
+
+void meteorFuncBatch(void (*func)(double *vals, const double *x,
+                                  const double *y, const double *z, int count))
+{
+   if(func)
+      FuncBatch = func;
+   else
+      FuncBatch = Func && Func != funcadapter ? funcbatchadapter : NULL;
+
+   /* keep using the scalar function where single values are needed */
+   if(!Func || Func == funcadapter)
+      Func = func ? funcadapter : NULL;
+}
+
+void meteorIntervalFunc(void (*func)(double range[2],
+                                     double min[3], double max[3]))
+{
+   IntervalFunc = func;
+}
+
+/* a bound from the value at the center of the box, the function can
+   change by at most Lipschitz times the distance from there */
+static void lipschitzinterval(double range[2], double min[3], double max[3])
+{
+   double c[3] = {(min[0] + max[0]) / 2, (min[1] + max[1]) / 2,
+                  (min[2] + max[2]) / 2};
+   double d[3] = {max[0] - c[0], max[1] - c[1], max[2] - c[2]};
+   double v = Func(c[0], c[1], c[2]);
+   double r = Lipschitz * sqrt(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+   range[0] = v - r;
+   range[1] = v + r;
+}
+
+void meteorLipschitz(double bound)
+{
+   Lipschitz = bound;
+   IntervalFunc = bound > 0 ? lipschitzinterval : NULL;
+}
+
+void meteorGradientFunc(void (*func)(double grad[3], double pos[3]))
+{
+   GradientFunc = func;
+}
+
+void meteorRefine(int method, int iterations, double tolerance)
+{
+   RefineMethod = method;
+   RefineIterations = iterations < 1 ? 1 : iterations;
+   RefineTolerance = tolerance;
+}
+
+double meteorRefineIterations(void)
+{
+   return RefineEdges ? (double)RefineEvaluations / RefineEdges : 0;
+}
+
+void meteorPolygonizer(int method)
+{
+   Polygonizer = method;
+}
+
+void meteorStream(void (*sink)(const double *points, int pointcount,
+                               const int *triangles, int trianglecount))
+{
+   StreamSink = sink;
 }
 
 void meteorNormalFunc(void (*func)(double[3], double[3]))
@@ -0,0 +1,351 @@
+/*
+ * Copyright (C) 2007  Sean D'Epagnier   All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Vertex clustering cuts the bounding box of the points into a grid of
+   cubes, and makes all the points in a cube into one.  The point left is
+   where the quadrics of the triangles around them add up to the least,
+   or their average if that can't be solved or is outside the cube.
+   Triangles left with two corners on the same point are removed.  Each
+   step is one pass over the points, cells or triangles, so unlike
+   aggregation the time only grows linearly, but where the surface passes
+   through a cell more than once its sides are joined together. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "internal.h"
+#include "meteor.h"
+
+#include "linalg.h"
+
+/* points or cells given to each thread at a time */
+#define CLUSTER_CHUNK 1024
+
+/* bits of a key for the cell along each axis */
+#define GRID_BITS 21
+#define GRID_CELLS (1 << GRID_BITS)
+
+/* most tries at a cell size that gives the number of points asked for */
+#define SIZE_PASSES 8
+
+struct cell {
+   mfloat Q[10], pos[3]; /* sums over the cell's triangles and points */
+   int count, point; /* the first point in the cell is the one kept */
+   int triangles; /* set if any triangle touches the cell */
+};
+
+static mfloat Min[3], Size;
+static long long *Keys; /* the cell of each point in the heap */
+static struct cell *Cells;
+static mfloat *CellData;
+
+static void keyworker(int i, void *arg)
+{
+   int j, k, end = (i + 1) * CLUSTER_CHUNK;
+   if(end > PointCount)
+      end = PointCount;
+   for(j = i * CLUSTER_CHUNK; j < end; j++) {
+      mfloat pos[3];
+      loadpos(pos, Heap[j]);
+      long long key = 0;
+      for(k = 0; k < 3; k++) {
+         long long x = (pos[k] - Min[k]) / Size;
+         if(x >= GRID_CELLS)
+            x = GRID_CELLS - 1;
+         key |= x << (GRID_BITS * k);
+      }
+      Keys[j] = key;
+   }
+}
+
+static void computekeys(void)
+{
+   ParallelRun((PointCount + CLUSTER_CHUNK - 1) / CLUSTER_CHUNK,
+               keyworker, NULL);
+}
+
+/* how many cells have points in them with the current size */
+static int countcells(void)
+{
+   computekeys();
+
+   struct hashtable h = {0};
+   int i, found;
+   for(i = 0; i < PointCount; i++)
+      hashInsert(&h, Keys[i], &found);
+
+   int count = h.count;
+   hashFree(&h);
+   return count;
+}
+
+/* Find the size that leaves the most cells without going over points, as
+   close as a few tries get.  The cells of a surface go with its area over
+   the size squared, so that gives the first size, and each try corrects
+   the size by the square root of how far off it was.  The count doesn't
+   always drop as the size grows, so it aims a little under, and once out
+   of tries it doubles the size until a count fits */
+static void findsize(int points, mfloat extent)
+{
+   mfloat area = 0;
+   int tri;
+   for(tri = TriNext[0]; tri; tri = TriNext[tri]) {
+      mfloat pos[3][3], v[2][3], n[3];
+      loadpos(pos[0], Corners[3*tri]);
+      loadpos(pos[1], Corners[3*tri + 1]);
+      loadpos(pos[2], Corners[3*tri + 2]);
+      sub3(v[0], pos[1], pos[0]);
+      sub3(v[1], pos[2], pos[0]);
+      cross(n, v[0], v[1]);
+      area += sqrt(dot(n, n)) / 2;
+   }
+
+   Size = area ? sqrt(area / points) : extent / cbrt(points);
+   if(!(Size > 0))
+      Size = 1;
+
+   mfloat lo = 0, hi = 0, best = 0;
+   int pass, bestcount = 0;
+   for(pass = 0; ; pass++) {
+      int count = countcells();
+      if(count <= points) {
+         if(count > bestcount)
+            best = Size, bestcount = count;
+         if(count >= .99 * points || pass >= SIZE_PASSES)
+            break;
+         hi = Size;
+      } else
+         lo = Size;
+
+      mfloat next = Size * sqrt(count / (.995 * points));
+      if(next <= lo || (hi && next >= hi) || (!hi && pass >= SIZE_PASSES))
+         next = hi ? (lo + hi) / 2 : 2 * lo;
+      Size = next;
+   }
+   Size = best;
+}
+
+static void solveworker(int i, void *arg)
+{
+   int j, k, n = 3 * DataParts, end = (i + 1) * CLUSTER_CHUNK;
+   int cells = *(int*)arg;
+   if(end > cells)
+      end = cells;
+   for(j = i * CLUSTER_CHUNK; j < end; j++) {
+      struct cell *cell = Cells + j;
+      if(cell->count == 1)
+         continue;
+
+      mfloat avg[3], pos[3];
+      for(k = 0; k < 3; k++)
+         avg[k] = cell->pos[k] / cell->count;
+
+      /* the average is in the cell, so it gives which one this is */
+      int inside = !solvespecial(pos, cell->Q);
+      for(k = 0; k < 3 && inside; k++) {
+         mfloat lo = floor((avg[k] - Min[k]) / Size) * Size + Min[k];
+         if(!(pos[k] >= lo && pos[k] <= lo + Size))
+            inside = 0;
+      }
+      storepos(cell->point, inside ? pos : avg);
+
+      if(n) {
+         mfloat *data = CellData + n * j;
+         for(k = 0; k < n; k++)
+            data[k] /= cell->count;
+         storedata(cell->point, data);
+         if(!LazyData)
+            UpdatePointData(cell->point);
+      }
+   }
+}
+
+/* Where the surface passes through a cell twice, triangles can end up on
+   the same points as one already in the rings.  If it faces the same way
+   tri is dropped, if it faces the other way it is a sheet folded flat and
+   both are.  Return whether tri was freed */
+static int duplicate(int tri)
+{
+   int *tp = Corners + 3*tri, c;
+   for(c = PointCorner[tp[0]]; c; c = CornerNext[c]) {
+      int next = Corners[nextcorner(c)], prev = Corners[prevcorner(c)];
+      if(next == tp[1] && prev == tp[2]) {
+         FreeTri(tri);
+         return 1;
+      }
+      if(next == tp[2] && prev == tp[1]) {
+         int other = c / 3, j;
+         for(j = 0; j < 3; j++)
+            removeCorner(3*other + j);
+         FreeTri(other);
+         FreeTri(tri);
+         return 1;
+      }
+   }
+   return 0;
+}
+
+/* merge the points in each cell of a grid, the cells are cubes of size
+   if it is positive, otherwise sized to leave about points points */
+int meteorCluster(int points, double size)
+{
+   if(TransformPending)
+      ApplyTransform();
+
+   int count = PointCount, i, j, k;
+   if(!count)
+      return 0;
+
+   if(points < 1)
+      points = 1;
+
+   mfloat max[3];
+   loadpos(Min, Heap[0]);
+   loadpos(max, Heap[0]);
+   for(i = 1; i < count; i++) {
+      mfloat pos[3];
+      loadpos(pos, Heap[i]);
+      for(k = 0; k < 3; k++) {
+         if(pos[k] < Min[k])
+            Min[k] = pos[k];
+         if(pos[k] > max[k])
+            max[k] = pos[k];
+      }
+   }
+
+   mfloat extent = 0;
+   for(k = 0; k < 3; k++)
+      if(max[k] - Min[k] > extent)
+         extent = max[k] - Min[k];
+
+   Keys = malloc(count * sizeof *Keys);
+   if(!Keys)
+      die("failed to allocate memory for clustering\n");
+
+   if(size > 0)
+      Size = size;
+   else
+      findsize(points, extent);
+
+   /* the keys only have room for so many cells */
+   if(extent / Size >= GRID_CELLS - 1)
+      Size = extent / (GRID_CELLS - 2);
+
+   computekeys();
+
+   /* number the cells, the keys are replaced by the numbers */
+   struct hashtable h = {0};
+   int cells = 0, found;
+   for(i = 0; i < count; i++) {
+      union hashitem *item = hashInsert(&h, Keys[i], &found);
+      if(!found)
+         item->point = cells++;
+      Keys[i] = item->point;
+   }
+   hashFree(&h);
+
+   int n = 3 * DataParts;
+   Cells = calloc(cells, sizeof *Cells);
+   CellData = calloc(cells * n + 1, sizeof *CellData);
+   if(!Cells || !CellData)
+      die("failed to allocate memory for clustering\n");
+
+   /* add up the points in each cell, and link each to the one kept */
+   for(i = 0; i < count; i++) {
+      int p = Heap[i];
+      struct cell *cell = Cells + Keys[i];
+      if(!cell->count++)
+         cell->point = p;
+      PointLink[p] = cell->point;
+
+      mfloat pos[3], data[MAX_DATA];
+      loadpos(pos, p);
+      add3(cell->pos, pos);
+      loaddata(data, p);
+      for(j = 0; j < n; j++)
+         CellData[n * Keys[i] + j] += data[j];
+   }
+
+   /* each triangle's quadric goes to each cell it touches once */
+   int tri;
+   for(tri = TriNext[0]; tri; tri = TriNext[tri]) {
+      int c[3];
+      for(j = 0; j < 3; j++)
+         c[j] = Keys[PointIndex[Corners[3*tri + j]]];
+
+      mfloat q[10];
+      TriQuadric(tri, q);
+      add4x4tri(Cells[c[0]].Q, q);
+      if(c[1] != c[0])
+         add4x4tri(Cells[c[1]].Q, q);
+      if(c[2] != c[0] && c[2] != c[1])
+         add4x4tri(Cells[c[2]].Q, q);
+      for(j = 0; j < 3; j++)
+         Cells[c[j]].triangles = 1;
+   }
+
+   ParallelRun((cells + CLUSTER_CHUNK - 1) / CLUSTER_CHUNK, solveworker,
+               &cells);
+   if(LazyData)
+      DataStale = 1;
+
+   /* move the triangles to the points kept, and take out the ones
+      that lost an edge */
+   int next;
+   for(tri = TriNext[0]; tri; tri = next) {
+      next = TriNext[tri];
+      int *tp = Corners + 3*tri;
+      for(j = 0; j < 3; j++)
+         tp[j] = PointLink[tp[j]];
+      if(tp[0] == tp[1] || tp[1] == tp[2] || tp[2] == tp[0])
+         FreeTri(tri);
+   }
+
+   /* the rings are made again from the triangles left */
+   for(i = 0; i < count; i++)
+      PointCorner[Heap[i]] = 0;
+   for(tri = TriNext[0]; tri; tri = next) {
+      next = TriNext[tri];
+      if(!duplicate(tri))
+         for(j = 0; j < 3; j++)
+            addCorner(3*tri + j);
+   }
+
+   /* free the other points, and the ones that lost all their triangles
+      to duplicates, and close up the heap */
+   for(i = j = 0; i < count; i++) {
+      int p = Heap[i];
+      if(PointLink[p] == p && (PointCorner[p] || !Cells[Keys[i]].triangles)) {
+         Heap[j] = p;
+         PointIndex[p] = j++;
+      } else
+         FreePoint(p);
+   }
+
+   free(Keys);
+   free(Cells);
+   free(CellData);
+
+   progressiveStale();
+
+   /* merging has to sort the points and queue the edges again */
+   heapMode = HEAP_NONE;
+   MeshModified = 1;
+   return count - PointCount;
+}
@@ -17,7 +17,7 @@ typedef long double long_double;
 int MeshModified;
 
 static int curpointind;
-static struct tri_t *curtri;
+static int curtri;
 static int lastpointmask, lasttrianglemask;
 
 #define ERROR(x) do { strcpy(meteorerror, __func__); strcat(meteorerror, ": "); \
@@ -27,7 +27,7 @@ void meteorRewind(void)
 {
    lastpointmask = lasttrianglemask = 0;
    curpointind = 0;
-   curtri = Tris->next;
+   curtri = TriNext[0];
 
    MeshModified = 0;
 }
@@ -46,23 +46,36 @@ void meteorRewind(void)
    if(MeshModified) \
       ERROR("Mesh has been modified since rewind")
 
+/* data put off with meteorLazyData is calculated before it is used, and
+   transformations put off are applied before the points are */
+#define UPDATE_DATA \
+   if(TransformPending) \
+      ApplyTransform(); \
+   if(DataStale && format & ~METEOR_COORDS) \
+      UpdateData()
+
 /* the routines that copy point data from the library to the user's buffer,
    they use macros to allow for conversions in each format */
 #define MAKE_TAKE_POINTDATA(type) \
-static void take_pointdata_##type(type **data, struct point_t *p, int format) \
+static void take_pointdata_##type(type **data, int p, int format) \
 { \
    if(format == METEOR_INDEX) { \
-      *(*data)++ = p->index; \
+      *(*data)++ = PointIndex[p]; \
       return; \
    } \
-   if(format & METEOR_COORDS) \
-      TAKE_DATA(p->pos); \
+   mfloat v[MAX_DATA]; \
+   if(format & METEOR_COORDS) { \
+      loadpos(v, p); \
+      TAKE_DATA(v); \
+   } \
+   if(format & ~METEOR_COORDS) \
+      loaddata(v, p); \
    if(format & METEOR_NORMALS) \
-      TAKE_DATA(p->data + NormalOffset); \
+      TAKE_DATA(v + NormalOffset); \
    if(format & METEOR_COLORS) \
-      TAKE_DATA(p->data + ColorOffset); \
+      TAKE_DATA(v + ColorOffset); \
    if(format & METEOR_TEXCOORDS) \
-      TAKE_DATA(p->data + TexCoordOffset); \
+      TAKE_DATA(v + TexCoordOffset); \
 }
 
 #define TAKE_DATA(x) (*data)[0] = (x)[0], (*data)[1] = (x)[1], (*data)[2] = (x)[2], *data+=3
@@ -83,6 +96,7 @@ int meteorReadPoints(int count, int format, int type, void *data)
    TEST_VALID_TYPE;
    TEST_VALID_FORMAT;
    TEST_MODIFIED;
+   UPDATE_DATA;
 
    int i;
    for(i = 0; i<count; i++) {
@@ -94,7 +108,7 @@ int meteorReadPoints(int count, int format, int type, void *data)
          lastpointmask |= format;
       take_pointdata[type](&data, Heap[curpointind], format);
 
-      if(Heap[curpointind]->index != curpointind) /* Sanity Check */
+      if(PointIndex[Heap[curpointind]] != curpointind) /* Sanity Check */
          die("Invalid Point!");
    }
    return i;
@@ -105,6 +119,7 @@ int meteorReadTriangles(int count, int format, int type, void *data)
    TEST_VALID_TYPE;
    TEST_VALID_FORMAT;
    TEST_MODIFIED;
+   UPDATE_DATA;
 
    int newf = format;
    if(newf == METEOR_INDEX)
@@ -114,34 +129,35 @@ int meteorReadTriangles(int count, int format, int type, void *data)
    for(i = 0; i<count; i++) {
       if(lasttrianglemask & newf) {
          lasttrianglemask = newf;
-         curtri = curtri->next;
+         curtri = TriNext[curtri];
       } else
          lasttrianglemask |= newf;
 
-      if(curtri == Tris)
+      if(!curtri)
          break;
 
       for(j = 0; j < 3; j++)
-         take_pointdata[type](&data, curtri->p[j], format);
+         take_pointdata[type](&data, Corners[3*curtri + j], format);
    }
    return i;
 }
 
 #define MAKE_PUT_POINTDATA(type) \
-static void put_pointdata_##type(type **data, struct point_t *p, int format) \
+static void put_pointdata_##type(type **data, mfloat *pos, mfloat *pdata, \
+                                 int *index, int format) \
 { \
    if(format == METEOR_INDEX) { \
-      p->index = *(*data)++; \
+      *index = *(*data)++; \
       return; \
    } \
    if(format & METEOR_COORDS) \
-      PUT_DATA(p->pos); \
+      PUT_DATA(pos); \
    if(format & METEOR_NORMALS) \
-      PUT_DATA(p->data + NormalOffset); \
+      PUT_DATA(pdata + NormalOffset); \
    if(format & METEOR_COLORS) \
-      PUT_DATA(p->data + ColorOffset); \
+      PUT_DATA(pdata + ColorOffset); \
    if(format & METEOR_TEXCOORDS) \
-      PUT_DATA(p->data + TexCoordOffset); \
+      PUT_DATA(pdata + TexCoordOffset); \
 }
 
 #define PUT_DATA(x) (x)[0] = (*data)[0], (x)[1] = (*data)[1], (x)[2] = (*data)[2], *data+=3
@@ -159,14 +175,13 @@ static void (*put_pointdata[])() = {put_pointdata_int,
 
 int meteorWritePoints(int count, int format, int type, const void *data)
 {
-   struct point_t *offset = NULL;
-
    TEST_VALID_TYPE;
    TEST_VALID_FORMAT;
+   UPDATE_DATA;
 
    int i;
    for(i = 0; i<count; i++) {
-      struct point_t *p;
+      int p;
       if(format & METEOR_COORDS) {
          p = NewPoint(); 
          lastpointmask = 0;
@@ -179,7 +194,15 @@ int meteorWritePoints(int count, int format, int type, const void *data)
             lastpointmask |= format;
          p = Heap[curpointind];
       }
-      put_pointdata[type](&data, p, format);
+      progressiveStale();
+
+      /* what isn't given is kept */
+      mfloat pos[3], pdata[MAX_DATA];
+      loadpos(pos, p);
+      loaddata(pdata, p);
+      put_pointdata[type](&data, pos, pdata, &PointIndex[p], format);
+      storepos(p, pos);
+      storedata(p, pdata);
    }
 
    return count;
@@ -193,32 +216,40 @@ int meteorWriteTriangles(int count, int format, int type, const void *data)
    if(!(format & METEOR_COORDS) && format != METEOR_INDEX)
       ERROR("Must have coordinate or index data when creating triangles\n");
 
-   char cp[3][sizeof(struct point_t) + 3 * DataParts * sizeof(mfloat)];
-   struct point_t *points[3] = {(struct point_t*)cp[0],
-                                (struct point_t*)cp[1],
-                                (struct point_t*)cp[2]};
+   /* the points are matched where they are after the transformations */
+   if(TransformPending)
+      ApplyTransform();
+
+   mfloat pos[3][3], pdata[3][3 * DataParts + 1];
+   int index[3];
    int i, j;
    for(i = 0; i<count; i++) {
-      struct point_t *p[3];
+      int p[3];
       for(j = 0; j < 3; j++) {
-	 put_pointdata[type](&data, points[j], format);
+	 put_pointdata[type](&data, pos[j], pdata[j], &index[j], format);
          if(format == METEOR_INDEX) {
             /* we are given the index of an existing point */
-            p[j] = Heap[points[j]->index];
-            if(points[j]->index < 0 || points[j]->index >= PointCount)
+            if(index[j] < 0 || index[j] >= PointCount)
                ERROR("Index out of range");
+            p[j] = Heap[index[j]];
          } else {
             /* we are given point data, so try to find an existing point with the
                same data, if it cannot be found, create a new point */
-            int m;
+            int m, k, l;
+            if(FloatStorage) {
+               /* compare with what would be stored */
+               for(k = 0; k < 3; k++)
+                  pos[j][k] = (float)pos[j][k];
+               for(k = 0; k < 3 * DataParts; k++)
+                  pdata[j][k] = (float)pdata[j][k];
+            }
             for(m = 0; m < PointCount; m++) {
-               struct point_t *q = Heap[m];
-               int k, l;
+               int q = Heap[m];
                for(k = 0; k < 3; k++) {
-                  if(q->pos[k] != points[j]->pos[k])
+                  if(getcoord(q, k) != pos[j][k])
                      goto nextpoint;
                   for(l = 0; l < DataParts; l++)
-                     if(q->data[l*3 + k] != points[j]->data[l*3 + k])
+                     if(getdata(q, l*3 + k) != pdata[j][l*3 + k])
                         goto nextpoint;
                }
 	       p[j] = q;
@@ -228,7 +259,8 @@ int meteorWriteTriangles(int count, int format, int type, const void *data)
             }
             /* couldn't find a point to match up, create it */
             p[j] = NewPoint();
-            memcpy(p[j], points[j], sizeof points[j]);
+            storepos(p[j], pos[j]);
+            storedata(p[j], pdata[j]);
          foundit:;
          }
       }
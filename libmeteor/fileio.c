@@ -19,13 +19,22 @@
 /* this file contains helper functions for saving and loading meteor data.
    without internal.h it is stand alone from the rest of the library. */
 
+#include "config.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 
 #include <math.h>
 
+#ifdef HAVE_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
 #include "meteor.h"
 
 #define TEXT_PRECISION "%.7g"
@@ -44,6 +53,10 @@ extern char meteorerror[256];
 #define TRY(x) do { if(x) { if(errno) strcpy(meteorerror, strerror(errno)); \
                                       newmeteorerror = 1; return -1; } } while(0)
 
+/* from thread.c, text is formatted and parsed by the threads meteorThreads
+   set */
+void ParallelRun(int count, void (*func)(int, void *), void *arg);
+
 static unsigned long tobyte(double val)
 {
    if(val >= 1.0)
@@ -53,6 +66,305 @@ static unsigned long tobyte(double val)
    return val * 255.0;
 }
 
+/* the text formats are saved a block at a time: each block is read with
+   one call, cut into chunks that the threads format into their own
+   buffers, and the buffers are written out in order */
+#define SAVE_BLOCK 65536
+#define SAVE_CHUNK 4096
+#define SAVE_CHUNKS (SAVE_BLOCK / SAVE_CHUNK)
+
+/* longest value TEXT_PRECISION gives, and a space */
+#define TEXT_VALUE 16
+
+/* longest line that isn't made of values */
+#define TEXT_LINE 128
+
+enum {LINE_VALUES, LINE_TRIANGLE, LINE_FACE, LINE_VIDEOSCAPE};
+
+struct textblock {
+   int line, count; /* the kind of line, and how many items there are */
+   const char *prefix;
+   int size, values; /* doubles read for each item, and how many written */
+   int dropzero; /* leave off the last value when it is 0 */
+   int format; /* what faces refer to */
+   double *data;
+   int *inds;
+   double *colors; /* of each point, for videoscape faces */
+   char *text[SAVE_CHUNKS];
+   int length[SAVE_CHUNKS];
+};
+
+static const double Powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+                                1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16,
+                                1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/* write v the same as TEXT_PRECISION would, returning the length.  The
+   digits come from scaling by a power of ten, which is exact, so the
+   scaled value is within an ulp, and printf is left the values where
+   that could change the rounding, and the ones out of range */
+static int formatvalue(char *s, double v)
+{
+   double a = fabs(v);
+   if(v == 0) {
+      char *c = s;
+      if(signbit(v))
+         *c++ = '-';
+      *c++ = '0', *c = '\0';
+      return c - s;
+   }
+   if(!(a >= 1e-15 && a < 1e15))
+      return sprintf(s, TEXT_PRECISION, v);
+
+   int e = floor(log10(a));
+   double m = e <= 6 ? a * Powers[6 - e] : a / Powers[e - 6];
+   if(m >= 1e7)
+      e++, m = e <= 6 ? a * Powers[6 - e] : a / Powers[e - 6];
+   else if(m < 1e6)
+      e--, m = e <= 6 ? a * Powers[6 - e] : a / Powers[e - 6];
+
+   double f = m - floor(m);
+   if(fabs(f - .5) < 1e-7)
+      return sprintf(s, TEXT_PRECISION, v);
+
+   int d = (int)floor(m) + (f > .5), digits[7], n = 7, i;
+   if(d == 10000000)
+      d = 1000000, e++;
+   for(i = 6; i >= 0; i--, d /= 10)
+      digits[i] = d % 10;
+   while(n > 1 && !digits[n - 1])
+      n--;
+
+   char *c = s;
+   if(v < 0)
+      *c++ = '-';
+   if(e >= -4 && e < 7) {
+      if(e < 0) {
+         *c++ = '0', *c++ = '.';
+         for(i = -1; i > e; i--)
+            *c++ = '0';
+         for(i = 0; i < n; i++)
+            *c++ = '0' + digits[i];
+      } else {
+         for(i = 0; i <= e; i++)
+            *c++ = '0' + digits[i];
+         if(n > e + 1)
+            for(*c++ = '.'; i < n; i++)
+               *c++ = '0' + digits[i];
+      }
+   } else {
+      *c++ = '0' + digits[0];
+      if(n > 1)
+         for(*c++ = '.', i = 1; i < n; i++)
+            *c++ = '0' + digits[i];
+      *c++ = 'e', *c++ = e < 0 ? '-' : '+';
+      e = abs(e);
+      *c++ = '0' + e / 10, *c++ = '0' + e % 10;
+   }
+   *c = '\0';
+   return c - s;
+}
+
+/* write n in base, returning the length */
+static int formatint(char *s, unsigned long n, int base)
+{
+   char digits[24];
+   int len = 0, i;
+   do
+      digits[len++] = "0123456789abcdef"[n % base];
+   while(n /= base);
+   for(i = 0; i < len; i++)
+      s[i] = digits[len - 1 - i];
+   return len;
+}
+
+static void textworker(int i, void *arg)
+{
+   struct textblock *b = arg;
+   int j, k, end = (i + 1) * SAVE_CHUNK;
+   if(end > b->count)
+      end = b->count;
+
+   char *c = b->text[i];
+   for(j = i * SAVE_CHUNK; j < end; j++) {
+      const double *d = b->data + b->size * j;
+      const int *inds = b->inds + 3 * j;
+      switch(b->line) {
+      case LINE_VALUES:
+         {
+            int values = b->dropzero && !d[b->values - 1]
+               ? b->values - 1 : b->values;
+            c = stpcpy(c, b->prefix);
+            for(k = 0; k < values; k++) {
+               if(k)
+                  *c++ = ' ';
+               c += formatvalue(c, d[k]);
+            }
+         } break;
+      case LINE_TRIANGLE:
+         for(k = 0; k < 3; k++) {
+            if(k)
+               *c++ = ' ';
+            c += formatint(c, inds[k], 10);
+         }
+         break;
+      case LINE_FACE:
+         *c++ = 'f';
+         for(k = 0; k < 3; k++) {
+            char num[16];
+            int len = formatint(num, inds[k] + 1, 10);
+            *c++ = ' ';
+            memcpy(c, num, len), c += len;
+            if(b->format & (METEOR_NORMALS | METEOR_TEXCOORDS))
+               *c++ = '/';
+            if(b->format & METEOR_TEXCOORDS)
+               memcpy(c, num, len), c += len;
+            if(b->format & METEOR_NORMALS) {
+               *c++ = '/';
+               memcpy(c, num, len), c += len;
+            }
+         }
+         break;
+      case LINE_VIDEOSCAPE:
+         {
+            unsigned long color = 0xffffff;
+            if(b->colors) {
+               const double *c0 = b->colors + 3 * inds[0];
+               const double *c1 = b->colors + 3 * inds[1];
+               const double *c2 = b->colors + 3 * inds[2];
+               color = tobyte((c0[0] + c1[0] + c2[0])/3) << 16
+                  | tobyte((c0[1] + c1[1] + c2[1])/3) << 8
+                  | tobyte((c0[2] + c1[2] + c2[2])/3) << 0;
+            }
+            *c++ = '3';
+            for(k = 0; k < 3; k++) {
+               *c++ = ' ';
+               c += formatint(c, inds[k], 10);
+            }
+            c = stpcpy(c, " 0x");
+            c += formatint(c, color, 16);
+         } break;
+      }
+      *c++ = '\n';
+   }
+   b->length[i] = c - b->text[i];
+}
+
+/* format the count items read into b, and write them in order */
+static int writeblock(FILE *file, struct textblock *b)
+{
+   int chunks = (b->count + SAVE_CHUNK - 1) / SAVE_CHUNK, i;
+   ParallelRun(chunks, textworker, b);
+   for(i = 0; i < chunks; i++)
+      TRY(fwrite(b->text[i], 1, b->length[i], file) != b->length[i]);
+   return 0;
+}
+
+/* write a line for each point of the given format */
+static int writepoints(FILE *file, struct textblock *b, int count,
+                       int format, int values, const char *prefix)
+{
+   int size = 3 * (!!(format & METEOR_COORDS) + !!(format & METEOR_NORMALS)
+                   + !!(format & METEOR_COLORS)
+                   + !!(format & METEOR_TEXCOORDS)), i, j, n;
+   b->line = LINE_VALUES;
+   b->prefix = prefix;
+   b->size = size;
+   b->values = values ? values : size;
+
+   /* videoscape faces are colored from their points */
+   int colors = 3 + 3 * !!(format & METEOR_NORMALS);
+   for(i = 0; i < count; i += n) {
+      n = count - i < SAVE_BLOCK ? count - i : SAVE_BLOCK;
+      TRY(meteorReadPoints(n, format, METEOR_DOUBLE, b->data) != n);
+      if(b->colors)
+         for(j = 0; j < n; j++)
+            memcpy(b->colors + 3 * (i + j), b->data + size * j + colors,
+                   3 * sizeof *b->colors);
+      b->count = n;
+      if(writeblock(file, b))
+         return -1;
+   }
+   return 0;
+}
+
+/* write a line for each triangle */
+static int writetriangles(FILE *file, struct textblock *b, int count,
+                          int line)
+{
+   int i, n;
+   b->line = line;
+   for(i = 0; i < count; i += n) {
+      n = count - i < SAVE_BLOCK ? count - i : SAVE_BLOCK;
+      TRY(meteorReadTriangles(n, METEOR_INDEX, METEOR_INT, b->inds) != n);
+      b->count = n;
+      if(writeblock(file, b))
+         return -1;
+   }
+   return 0;
+}
+
+/* the text formats after their headers */
+static int savetext(FILE *file, int fileformat, int format,
+                    int points, int triangles)
+{
+   struct textblock b = {0};
+   int i, r = -1;
+   b.format = format;
+   b.data = malloc(SAVE_BLOCK * 12 * sizeof *b.data);
+   b.inds = malloc(SAVE_BLOCK * 3 * sizeof *b.inds);
+   if(fileformat == METEOR_FILE_FORMAT_VIDEOSCAPE && format & METEOR_COLORS)
+      b.colors = malloc((points + 1) * 3 * sizeof *b.colors);
+   for(i = 0; i < SAVE_CHUNKS; i++)
+      b.text[i] = malloc(SAVE_CHUNK * (12 * TEXT_VALUE + TEXT_LINE));
+   if(!b.data || !b.inds || !b.text[SAVE_CHUNKS - 1]
+      || (fileformat == METEOR_FILE_FORMAT_VIDEOSCAPE
+          && format & METEOR_COLORS && !b.colors)) {
+      strcpy(meteorerror, "Out of memory");
+      newmeteorerror = 1;
+      goto out;
+   }
+
+   switch(fileformat) {
+   case METEOR_FILE_FORMAT_TEXT:
+      if(writepoints(file, &b, points, format, 0, "")
+         || writetriangles(file, &b, triangles, LINE_TRIANGLE))
+         goto out;
+      break;
+   case METEOR_FILE_FORMAT_WAVEFRONT:
+      if(writepoints(file, &b, points, METEOR_COORDS, 0, "v "))
+         goto out;
+
+      meteorRewind();
+      if(format & METEOR_NORMALS
+         && writepoints(file, &b, points, METEOR_NORMALS, 0, "vn "))
+         goto out;
+
+      meteorRewind();
+      b.dropzero = 1;
+      if(format & METEOR_TEXCOORDS
+         && writepoints(file, &b, points, METEOR_TEXCOORDS, 0, "vt "))
+         goto out;
+
+      if(writetriangles(file, &b, triangles, LINE_FACE))
+         goto out;
+      break;
+   case METEOR_FILE_FORMAT_VIDEOSCAPE:
+      if(writepoints(file, &b, points, format, 3, "")
+         || writetriangles(file, &b, triangles, LINE_VIDEOSCAPE))
+         goto out;
+      break;
+   }
+   r = 0;
+
+ out:
+   free(b.data);
+   free(b.inds);
+   free(b.colors);
+   for(i = 0; i < SAVE_CHUNKS; i++)
+      free(b.text[i]);
+   return r;
+}
+
 int meteorSave(FILE *file, int fileformat)
 {
    int line = 0;
@@ -60,13 +372,14 @@ int meteorSave(FILE *file, int fileformat)
       switch(fileformat) {
       case METEOR_FILE_FORMAT_TEXT:      case METEOR_FILE_FORMAT_BINARY:
       case METEOR_FILE_FORMAT_WAVEFRONT: case METEOR_FILE_FORMAT_VIDEOSCAPE:
+      case METEOR_FILE_FORMAT_PROGRESSIVE:
          return 0;
       }
       ERROR("Format not available");
    }
 
    int format = meteorFormat();
-   int points = meteorPointCount(), triangles = meteorTriangleCount();
+   int points = meteorPointCount(), triangles = meteorTriangleCount(), splits;
    switch(fileformat) {
    case METEOR_FILE_FORMAT_TEXT:
       TRY(fprintf(file, "%d %d %d\n", format, points, triangles) < 1);
@@ -84,6 +397,15 @@ int meteorSave(FILE *file, int fileformat)
       TRY(!fputs("3DG1\n", file));
       TRY(fprintf(file, "%d\n", points) == 0);
       break;
+   case METEOR_FILE_FORMAT_PROGRESSIVE:
+      /* the base mesh, then each split with the triangles it adds */
+      splits = meteorProgressiveSize(&points, &triangles);
+      if(!points)
+         ERROR("No merges recorded");
+      TRY(!fputs("METEORPM\n", file));
+      TRY(fprintf(file, "%d %d %d %d\n", format, points, triangles, splits) < 1);
+      line = 2;
+      break;
    default:
       ERROR("Format not available");
    }
@@ -98,18 +420,9 @@ int meteorSave(FILE *file, int fileformat)
 
    switch(fileformat) {
    case METEOR_FILE_FORMAT_TEXT:
-      for(i=0; i<points; i++) {
-         TRY(meteorReadPoints(1, format, METEOR_DOUBLE, data) != 1);
-         int c = fprintf(file, TEXT_PRECISION3, data[0], data[1], data[2]);
-         for(j = 3; j <= 3*dataparts; j+=3)
-            c += fprintf(file, " "TEXT_PRECISION3, data[j+0], data[j+1], data[j+2]);
-         TRY(c <= 0 || fputc('\n', file) == EOF);
-      }
-      for(i = 0; i<triangles; i++) {
-         TRY(meteorReadTriangles(1, METEOR_INDEX, METEOR_INT, inds) != 1);
-         TRY(fprintf(file, "%d %d %d\n", inds[0], inds[1], inds[2]) < 0);
-      }
-      break;
+   case METEOR_FILE_FORMAT_WAVEFRONT:
+   case METEOR_FILE_FORMAT_VIDEOSCAPE:
+      return savetext(file, fileformat, format, points, triangles);
    case METEOR_FILE_FORMAT_BINARY:
       for(i=0; i<points; i++) {
          TRY(meteorReadPoints(1, format, METEOR_DOUBLE, data) != 1);
@@ -120,89 +433,349 @@ int meteorSave(FILE *file, int fileformat)
          TRY(fwrite(inds, 3 * (sizeof *inds), 1, file) != 1);
       }
       break;
-   case METEOR_FILE_FORMAT_WAVEFRONT:
-      for(i=0; i<points; i++) {
-         TRY(meteorReadPoints(1, METEOR_COORDS, METEOR_DOUBLE, data) != 1);
-         TRY(fprintf(file, "v "TEXT_PRECISION3"\n",
-                     data[0], data[1], data[2]) < 1);
-      }
+   case METEOR_FILE_FORMAT_PROGRESSIVE:
+      {
+         int size = 3 * (dataparts + 1), tri = 0, k;
+         double split[2 + 24];
+         for(i = 0; i < points + splits; i++) {
+            TRY(meteorReadProgressivePoints(i, 1, split) != 1);
+            int c = 0, n = size;
+            if(i >= points) {
+               c = fprintf(file, "%d %d ", (int)split[0], (int)split[1]);
+               n = 2 * size;
+            }
+            for(j = 0; j < n; j+=3)
+               c += fprintf(file, j ? " "TEXT_PRECISION3 : TEXT_PRECISION3,
+                            split[2+j], split[2+j+1], split[2+j+2]);
+            TRY(c <= 0 || fputc('\n', file) == EOF);
+
+            /* the base triangles follow the last base point */
+            n = i < points ? (i == points - 1 ? triangles : 0) : split[1];
+            for(k = 0; k < n; k++) {
+               TRY(meteorReadProgressiveTriangles(tri++, 1, inds) != 1);
+               TRY(fprintf(file, "%d %d %d\n", inds[0], inds[1], inds[2]) < 0);
+            }
+         }
+      } break;
+   }
 
-      meteorRewind();
+   return 0;
+}
 
-      if(format & METEOR_NORMALS)
-         for(i=0; i<points; i++) {
-            TRY(meteorReadPoints(1, METEOR_NORMALS, METEOR_DOUBLE, data) != 1);
-            TRY(fprintf(file, "vn "TEXT_PRECISION3"\n",
-                        data[0], data[1], data[2]) < 1);
-         }
+/* the text format is loaded from the rest of the file mapped into memory,
+   or read into memory when it can't be mapped, like from a pipe.  The
+   lines of a block are found in one pass, then parsed in chunks by the
+   threads, and the block is written with one call */
+#define LOAD_BLOCK 65536
+#define LOAD_CHUNK 4096
+
+struct textsource {
+   char *base; /* what was mapped or read */
+   size_t size;
+   int mapped;
+   long offset; /* where the stream was in the file */
+   const char *pos, *end; /* what is left to load */
+};
+
+/* get the rest of file, return -1 if it can't be read */
+static int opensource(FILE *file, struct textsource *src)
+{
+   memset(src, 0, sizeof *src);
+#ifdef HAVE_MMAP
+   struct stat st;
+   src->offset = ftell(file);
+   if(src->offset >= 0 && !fstat(fileno(file), &st) && S_ISREG(st.st_mode)
+      && st.st_size > src->offset) {
+      void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                       fileno(file), 0);
+      if(map != MAP_FAILED) {
+         src->base = map;
+         src->size = st.st_size;
+         src->mapped = 1;
+         src->pos = src->base + src->offset;
+         src->end = src->base + src->size;
+         return 0;
+      }
+   }
+#endif
+
+   size_t slots = 0, n;
+   do {
+      if(src->size == slots) {
+         slots = slots ? 2 * slots : 1 << 20;
+         char *base = realloc(src->base, slots);
+         if(!base)
+            return -1;
+         src->base = base;
+      }
+      n = fread(src->base + src->size, 1, slots - src->size, file);
+      src->size += n;
+   } while(n);
+   if(ferror(file))
+      return -1;
+   src->pos = src->base;
+   src->end = src->base + src->size;
+   return 0;
+}
 
-      meteorRewind();
+/* leave the stream after what was loaded, if it was mapped */
+static void closesource(FILE *file, struct textsource *src)
+{
+#ifdef HAVE_MMAP
+   if(src->mapped) {
+      fseek(file, src->pos - src->base, SEEK_SET);
+      munmap(src->base, src->size);
+      return;
+   }
+#endif
+   free(src->base);
+}
 
-      if(format & METEOR_TEXCOORDS)
-         for(i=0; i<points; i++) {
-            TRY(meteorReadPoints(1, METEOR_TEXCOORDS, METEOR_DOUBLE, data) != 1);
-            if(data[2])
-               TRY(fprintf(file, "vt "TEXT_PRECISION3"\n",
-                           data[0], data[1], data[2]) < 1);
-            else
-               TRY(fprintf(file, "vt "TEXT_PRECISION2"\n",
-                        data[0], data[1]) < 1);
-         }
+static int blank(char c)
+{
+   return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
 
-      for(i = 0; i<triangles; i++) {
-         TRY(meteorReadTriangles(1, METEOR_INDEX, METEOR_INT, inds) != 1);
-         TRY(fprintf(file, "f") < 1);
-         for(j = 0; j<3; j++) {
-            char num[20];
-            sprintf(num, "%d", inds[j] + 1);
-            if(format & METEOR_NORMALS)
-               TRY(fprintf(file, " %s/%s/%s", num,
-                           format & METEOR_TEXCOORDS ? num : "", num) < 1);
-            else
-               TRY(fprintf(file, " %s%s%s", num,
-                           format & METEOR_TEXCOORDS ? "/" : "",
-                           format & METEOR_TEXCOORDS ? num : "") < 1);
-         }
-         TRY(fprintf(file, "\n") < 1);
+static int digit(char c)
+{
+   return c >= '0' && c <= '9';
+}
+
+/* Parse a number the way strtod does in the C locale, whatever the locale
+   is, returning the end of it or NULL if there is none.  Up to 15 digits
+   with a small exponent are converted exactly by one multiply or divide by
+   a power of ten, anything else is copied out for strtod */
+static const char *parsevalue(const char *c, const char *end, double *v)
+{
+   const char *start = c;
+   unsigned long long m = 0;
+   int neg = 0, digits = 0, exp = 0, any = 0;
+   if(c < end && (*c == '-' || *c == '+'))
+      neg = *c++ == '-';
+   for(; c < end && digit(*c); c++, any = 1) {
+      if(m || *c != '0') {
+         if(digits++ < 18)
+            m = 10 * m + (*c - '0');
+         else
+            exp++;
       }
-      break;
-   case METEOR_FILE_FORMAT_VIDEOSCAPE:
-      for(i=0; i<points; i++) {
-         TRY(meteorReadPoints(1, format, METEOR_DOUBLE, data) != 1);
-         TRY(fprintf(file, TEXT_PRECISION3"\n", data[0], data[1], data[2]) < 1);
+   }
+   if(c < end && *c == '.') {
+      for(c++; c < end && digit(*c); c++, any = 1) {
+         if(m || *c != '0') {
+            if(digits++ < 18)
+               m = 10 * m + (*c - '0'), exp--;
+         } else
+            exp--;
       }
-      
-      unsigned long color = 0xffffff;
-      for(i = 0; i<triangles; i++) {            
-         TRY(meteorReadTriangles(1, METEOR_INDEX, METEOR_INT, inds) != 1);
+   }
+   if(any && c < end && (*c == 'e' || *c == 'E')) {
+      const char *e = c + 1;
+      int eneg = 0, n = 0;
+      if(e < end && (*e == '-' || *e == '+'))
+         eneg = *e++ == '-';
+      if(e < end && digit(*e)) {
+         for(; e < end && digit(*e); e++)
+            if(n < 10000)
+               n = 10 * n + (*e - '0');
+         exp += eneg ? -n : n;
+         c = e;
+      }
+   }
 
-         if(format & METEOR_COLORS) {
-            TRY(meteorReadTriangles(1, METEOR_COLORS, METEOR_DOUBLE, data) != 1);
-            color = tobyte((data[0] + data[3] + data[6])/3) << 16
-               | tobyte((data[1] + data[4] + data[7])/3) << 8
-               | tobyte((data[2] + data[5] + data[8])/3) << 0;
-         }
-         TRY(fprintf(file, "3 %d %d %d 0x%x\n", inds[0], inds[1], inds[2], color) == 0);
+   if(any && digits <= 15 && exp >= -22 && exp <= 22
+      && !(c < end && (*c == 'x' || *c == 'X'))) {
+      *v = exp < 0 ? m / Powers[-exp] : m * Powers[exp];
+      if(neg)
+         *v = -*v;
+      return c;
+   }
+
+   /* inf, nan, hex, or too many digits */
+   for(c = start; c < end && !blank(*c) && *c != '\n'; c++);
+   size_t n = c - start;
+   char buf[64], *copy = n < sizeof buf ? buf : malloc(n + 1), *endptr;
+   if(!n || !copy)
+      return NULL;
+   memcpy(copy, start, n);
+   copy[n] = '\0';
+   *v = strtod(copy, &endptr);
+   if(endptr != copy + n)
+      c = NULL;
+   if(copy != buf)
+      free(copy);
+   return c;
+}
+
+static const char *parseint(const char *c, const char *end, int *v)
+{
+   int neg = 0;
+   long long n = 0;
+   if(c < end && (*c == '-' || *c == '+'))
+      neg = *c++ == '-';
+   if(c == end || !digit(*c))
+      return NULL;
+   for(; c < end && digit(*c); c++)
+      if((n = 10 * n + (*c - '0')) > INT_MAX)
+         return NULL;
+   *v = neg ? -n : n;
+   return c;
+}
+
+struct textload {
+   int count, size; /* lines in the block, and values on each */
+   int triangles; /* the lines are triangles instead of points */
+   int points; /* triangle indexes have to be below this */
+   const char **lines;
+   const char *end;
+   double *data;
+   int *inds;
+   int error[LOAD_BLOCK / LOAD_CHUNK]; /* first bad line of each chunk */
+};
+
+/* parse line j of the block, return if it is good */
+static int parseline(struct textload *l, int j)
+{
+   const char *c = l->lines[j];
+   int i;
+   for(i = 0; i < l->size; i++) {
+      while(c < l->end && blank(*c))
+         c++;
+      if(l->triangles) {
+         int *inds = l->inds + 3 * j;
+         c = parseint(c, l->end, inds + i);
+         if(c && (inds[i] < 0 || inds[i] >= l->points))
+            return 0;
+      } else
+         c = parsevalue(c, l->end, l->data + l->size * j + i);
+      if(!c || (c < l->end && !blank(*c) && *c != '\n'))
+         return 0;
+   }
+   while(c < l->end && blank(*c))
+      c++;
+   return c == l->end || *c == '\n';
+}
+
+static void loadworker(int i, void *arg)
+{
+   struct textload *l = arg;
+   int j, end = (i + 1) * LOAD_CHUNK;
+   if(end > l->count)
+      end = l->count;
+
+   l->error[i] = -1;
+   for(j = i * LOAD_CHUNK; j < end; j++)
+      if(!parseline(l, j)) {
+         l->error[i] = j;
+         break;
       }
-      break;
+}
+
+/* find up to count lines that aren't blank, return how many there are */
+static int findlines(struct textsource *src, const char **lines, int count)
+{
+   int n;
+   for(n = 0; n < count && src->pos < src->end; ) {
+      const char *c = src->pos;
+      while(c < src->end && blank(*c))
+         c++;
+      const char *eol = memchr(c, '\n', src->end - c);
+      src->pos = eol ? eol + 1 : src->end;
+      if(c < src->end && *c != '\n')
+         lines[n++] = c;
    }
+   return n;
+}
+
+/* line in the file of c, the lines of src start at first */
+static int linenumber(struct textsource *src, const char *c, int first)
+{
+   const char *p = src->base + (src->mapped ? src->offset : 0);
+   for(; p < c; p++)
+      if(*p == '\n')
+         first++;
+   return first;
+}
 
+/* load count lines of points with format, or of triangles */
+static int loadlines(struct textsource *src, struct textload *l, int count,
+                     int format)
+{
+   int line = 0, i, j, n;
+   for(i = 0; i < count; i += n) {
+      n = count - i < LOAD_BLOCK ? count - i : LOAD_BLOCK;
+      if(findlines(src, l->lines, n) != n) {
+         line = linenumber(src, src->end, 2);
+         ERROR("Unexpected end of file");
+      }
+      l->count = n;
+      int chunks = (n + LOAD_CHUNK - 1) / LOAD_CHUNK;
+      ParallelRun(chunks, loadworker, l);
+
+      for(j = 0; j < chunks; j++)
+         if(l->error[j] >= 0) {
+            line = linenumber(src, l->lines[l->error[j]], 2);
+            if(l->triangles)
+               ERROR("Invalid triangle");
+            ERROR("Invalid point");
+         }
+
+      if(l->triangles)
+         TRY(meteorWriteTriangles(n, METEOR_INDEX, METEOR_INT, l->inds) != n);
+      else
+         TRY(meteorWritePoints(n, format, METEOR_DOUBLE, l->data) != n);
+   }
    return 0;
 }
 
+/* the text format after its header */
+static int loadtext(FILE *file, int format, int points, int triangles)
+{
+   struct textsource src;
+   struct textload l = {0};
+   int r = -1, size = 3 * (1 + !!(format & METEOR_NORMALS)
+                           + !!(format & METEOR_COLORS)
+                           + !!(format & METEOR_TEXCOORDS));
+   l.size = size;
+   l.points = points;
+   l.lines = malloc(LOAD_BLOCK * sizeof *l.lines);
+   l.data = malloc(LOAD_BLOCK * size * sizeof *l.data);
+   l.inds = malloc(LOAD_BLOCK * 3 * sizeof *l.inds);
+   errno = 0;
+   if(!l.lines || !l.data || !l.inds || opensource(file, &src)) {
+      free(l.lines), free(l.data), free(l.inds);
+      strcpy(meteorerror, errno ? strerror(errno) : "Out of memory");
+      newmeteorerror = 1;
+      return -1;
+   }
+   l.end = src.end;
+
+   if(!loadlines(&src, &l, points, format)) {
+      l.size = 3;
+      l.triangles = 1;
+      r = loadlines(&src, &l, triangles, METEOR_INDEX);
+   }
+
+   closesource(file, &src);
+   free(l.lines);
+   free(l.data);
+   free(l.inds);
+   return r;
+}
+
 int meteorLoad(FILE *file, int fileformat)
 {
    int line = 0;
    if(!file) {
       switch(fileformat) {
       case METEOR_FILE_FORMAT_TEXT:       case METEOR_FILE_FORMAT_BINARY:
-      case METEOR_FILE_FORMAT_VIDEOSCAPE:
+      case METEOR_FILE_FORMAT_VIDEOSCAPE: case METEOR_FILE_FORMAT_PROGRESSIVE:
          return 0;
       }
       ERROR("Format not available");
    }
 
-   int i, j, format, points, triangles;
+   int i, j, format, points, triangles, splits;
 
    switch(fileformat) {
    case METEOR_FILE_FORMAT_TEXT:
@@ -229,6 +802,21 @@ int meteorLoad(FILE *file, int fileformat)
          format = METEOR_COORDS | METEOR_COLORS;
          TRY(fscanf(file, "%d\n", &points) != 1);
       } break;
+   case METEOR_FILE_FORMAT_PROGRESSIVE:
+      {
+         char buffer[1024];
+         line = 1;
+         TRY(!fgets(buffer, sizeof buffer, file));
+         if(strcmp(buffer, "METEORPM\n"))
+            ERROR("Unhandled magic number: %s", buffer);
+         line++;
+         TRY(fscanf(file, "%d %d %d %d\n", &format, &points, &triangles,
+                    &splits) != 4);
+         if(format & ~(METEOR_COORDS | METEOR_NORMALS
+                       | METEOR_COLORS | METEOR_TEXCOORDS))
+            ERROR("Invalid format");
+         line++;
+      } break;
    default:
       ERROR("Format not available");
    }
@@ -243,22 +831,7 @@ int meteorLoad(FILE *file, int fileformat)
 
    switch(fileformat) {
    case METEOR_FILE_FORMAT_TEXT:
-      for(i=0; i<points; i++) {
-         int c = fscanf(file, "%lf %lf %lf", data+0, data+1, data+2);
-         int j;
-         for(j = 3; j <= 3*dataparts; j+=3)
-            c += fscanf(file, " %lf %lf %lf", data+j+0, data+j+1, data+j+2);
-         TRY(c != 3*(dataparts + 1));
-         TRY(meteorWritePoints(1, format, METEOR_DOUBLE, data) != 1);
-         line++;
-      }
-
-      for(i = 0; i<triangles; i++) {
-         TRY(fscanf(file, "%d %d %d\n", inds+0, inds+1, inds+2) != 3);
-         TRY(meteorWriteTriangles(1, METEOR_INDEX, METEOR_INT, inds) != 1);
-         line++;
-      }
-      break;
+      return loadtext(file, format, points, triangles);
    case METEOR_FILE_FORMAT_BINARY:
       for(i=0; i<points; i++) {
          TRY(fread(data, 3 * (sizeof *data) * (dataparts + 1), 1, file) != 1);
@@ -336,6 +909,34 @@ int meteorLoad(FILE *file, int fileformat)
       }
       free(avgcolor);
       break;
+   case METEOR_FILE_FORMAT_PROGRESSIVE:
+      {
+         int size = 3 * (dataparts + 1), n, k;
+         double split[2 + 24];
+         for(i = 0; i < points + splits; i++) {
+            if(i < points) {
+               /* base points have no parent */
+               split[0] = -1, split[1] = 0;
+               for(j = 0; j < size; j++)
+                  TRY(fscanf(file, "%lf", split + 2 + j) != 1);
+               memcpy(split + 2 + size, split + 2, size * sizeof *split);
+            } else
+               for(j = 0; j < 2 + 2 * size; j++)
+                  TRY(fscanf(file, "%lf", split + j) != 1);
+            TRY(meteorWriteProgressivePoints(1, split) != 1);
+            line++;
+
+            n = i < points ? (i == points - 1 ? triangles : 0) : split[1];
+            for(k = 0; k < n; k++) {
+               TRY(fscanf(file, "%d %d %d\n", inds+0, inds+1, inds+2) != 3);
+               TRY(meteorWriteProgressiveTriangles(1, inds) != 1);
+               line++;
+            }
+         }
+
+         /* start with the whole mesh */
+         TRY(meteorProgressiveLevel(INT_MAX) == -1);
+      } break;
    }
    return 0;
 }
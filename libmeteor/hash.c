@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2007  Sean D'Epagnier   All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* hash table keyed by 64 bit integers, open addressing with linear probing */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "internal.h"
+
+#define EMPTY -1
+
+static inline unsigned int hashkey(long long key, int size)
+{
+   /* fibonacci hashing spreads the lattice indexes used as keys */
+   return (unsigned long long)key * 11400714819323198485ull >> 32 & (size - 1);
+}
+
+static void grow(struct hashtable *h)
+{
+   int i, oldsize = h->size;
+   long long *oldkeys = h->keys;
+   union hashitem *olditems = h->items;
+
+   h->size = oldsize ? 2 * oldsize : 1024;
+   h->keys = malloc(h->size * sizeof *h->keys);
+   h->items = malloc(h->size * sizeof *h->items);
+   if(!h->keys || !h->items)
+      die("failed to allocate hash table of %d items\n", h->size);
+
+   for(i = 0; i < h->size; i++)
+      h->keys[i] = EMPTY;
+
+   for(i = 0; i < oldsize; i++)
+      if(oldkeys[i] != EMPTY) {
+         unsigned int j = hashkey(oldkeys[i], h->size);
+         while(h->keys[j] != EMPTY)
+            j = (j + 1) & (h->size - 1);
+         h->keys[j] = oldkeys[i];
+         h->items[j] = olditems[i];
+      }
+
+   free(oldkeys);
+   free(olditems);
+}
+
+/* find the item for key, or NULL if it isn't in the table */
+union hashitem *hashFind(struct hashtable *h, long long key)
+{
+   if(!h->size)
+      return NULL;
+
+   unsigned int i = hashkey(key, h->size);
+   while(h->keys[i] != key) {
+      if(h->keys[i] == EMPTY)
+         return NULL;
+      i = (i + 1) & (h->size - 1);
+   }
+   return h->items + i;
+}
+
+/* find the item for key (keys must not be negative), adding it if needed,
+   found is set if it was already there.  The item returned is only valid
+   until the next insert */
+union hashitem *hashInsert(struct hashtable *h, long long key, int *found)
+{
+   /* keep the table at most half full */
+   if(2 * (h->count + 1) > h->size)
+      grow(h);
+
+   unsigned int i = hashkey(key, h->size);
+   while(h->keys[i] != key) {
+      if(h->keys[i] == EMPTY) {
+         h->keys[i] = key;
+         h->count++;
+         *found = 0;
+         return h->items + i;
+      }
+      i = (i + 1) & (h->size - 1);
+   }
+   *found = 1;
+   return h->items + i;
+}
+
+void hashFree(struct hashtable *h)
+{
+   free(h->keys);
+   free(h->items);
+   h->keys = NULL;
+   h->items = NULL;
+   h->size = h->count = 0;
+}
@@ -16,93 +16,143 @@
  * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+/* The heap keeps the cost of each point next to it in HeapCost, so
+   comparisons while sifting read one array in order instead of looking
+   each point's cost up in PointCost.  It is 4-ary, the children of a node
+   are next to each other and the tree is half as deep as a binary one.
+   A cost is copied in when its point is inserted or updated, so PointCost
+   must not change for a point in the heap without calling heapUpdate.
+
+   Compiled with HEAP_TRACE, every operation is written to heap.trace
+   for heapbench to replay. */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include "internal.h"
 
-#define min(x, y) (x < y ? x : y)
-
 static int maxsize; /* number of elements currently allocated for space */
-struct point_t **Heap; /* heap data, packed binary tree */
+int *Heap; /* heap data, packed 4-ary tree */
+mfloat *HeapCost; /* cost of each point in the sorted part of Heap */
 
 int heapSize; /* size of sorted data, there are always PointCount in the heap */
 int heapMode; /* what the heap is currently used for */
 
+#ifdef HEAP_TRACE
+static void trace(int op, int p)
+{
+   static FILE *file;
+   if(!file && !(file = fopen("heap.trace", "wb")))
+      die("failed to open heap.trace\n");
+
+   struct heaptrace t = {op, p, PointCost[p]};
+   fwrite(&t, sizeof t, 1, file);
+}
+#else
+#define trace(op, p)
+#endif
+
 static inline int parent(int a) {
-   return  (a-!(a&1)) >> 1;
+   return (a - 1) / HEAP_ARITY;
 }
 
 static inline int child(int a) {
-   return (a<<1) + 1;
+   return HEAP_ARITY*a + 1;
+}
+
+static inline void place(int n, int p, mfloat cost)
+{
+   Heap[n] = p;
+   HeapCost[n] = cost;
+   PointIndex[p] = n;
+}
+
+/* move p with cost toward the top starting from the hole at n */
+static inline void siftup(int n, int p, mfloat cost)
+{
+   while(n > 0) {
+      int o = parent(n);
+      if(HeapCost[o] <= cost)
+         break;
+      place(n, Heap[o], HeapCost[o]);
+      n = o;
+   }
+   place(n, p, cost);
 }
 
-void heapInsertUnsorted(struct point_t *p) {
+/* move p with cost toward the bottom starting from the hole at n */
+static inline void siftdown(int n, int p, mfloat cost)
+{
+   for(;;) {
+      int c = child(n), end = c + HEAP_ARITY, m = -1;
+      mfloat min = cost;
+      if(end > heapSize)
+         end = heapSize;
+      for(; c < end; c++)
+         if(HeapCost[c] < min) {
+            min = HeapCost[c];
+            m = c;
+         }
+      if(m < 0)
+         break;
+      place(n, Heap[m], min);
+      n = m;
+   }
+   place(n, p, cost);
+}
+
+void heapInsertUnsorted(int p) {
+   trace(HEAP_TRACE_UNSORTED, p);
+
    /* make sure we have enough storage */
    if(PointCount > maxsize) {
       maxsize = PointCount*2;
       Heap = realloc(Heap, maxsize * (sizeof *Heap));
+      HeapCost = realloc(HeapCost, maxsize * (sizeof *HeapCost));
    }
 
-   p->index = PointCount - 1;
+   PointIndex[p] = PointCount - 1;
    Heap[PointCount - 1] = p;
 }
 
-void heapInsert(struct point_t *p) {
-   int n = heapSize++;
-
-   for(;;) {
-      int o = parent(n);
-      if(n == 0 || Heap[o]->cost <= p->cost) {
-         p->index = n;
-	 Heap[n] = p;
-	 break;
-      }
-
-      Heap[n] = Heap[o];
-      Heap[n]->index = n;
-      n = o;
-   }
+void heapInsert(int p) {
+   trace(HEAP_TRACE_INSERT, p);
+   siftup(heapSize++, p, PointCost[p]);
 }
 
-void heapRemove(struct point_t *p)
+void heapRemove(int p)
 {
-   int c, o;
+   trace(HEAP_TRACE_REMOVE, p);
 #ifdef DEBUG
    if(heapSize == 0)
       die("cannot remove from empty heap\n");
 #endif
 
-   heapSize--;
-
-   /* if p->index is -1 then p has been deleted, there is a bug somewhere else */
-   o = p->index;
-   c = child(o);
-   while(c < heapSize && min(Heap[c]->cost, Heap[c+1]->cost) < Heap[heapSize]->cost) {
-      if(Heap[c]->cost > Heap[c+1]->cost)
-	 c++;
-
-      Heap[o] = Heap[c];
-      Heap[o]->index = o;
-
-      o = c;
-      c = child(c);
-   }
-
-   int par = parent(o);
-   while(o > 0 && Heap[par]->cost > Heap[heapSize]->cost) {
-      Heap[o] = Heap[par];
-      Heap[o]->index = o;
-
-      o = par;
-      par = parent(par);
-   }
-
-   Heap[o] = Heap[heapSize];
-   Heap[o]->index = o;
+   /* if the index is -1 then p has been deleted, there is a bug somewhere else */
+   int o = PointIndex[p], last = Heap[--heapSize];
+   if(o == heapSize)
+      return;
+
+   /* the last point fills the hole, and moves whichever way it has to */
+   mfloat cost = HeapCost[heapSize];
+   if(o > 0 && cost < HeapCost[parent(o)])
+      siftup(o, last, cost);
+   else
+      siftdown(o, last, cost);
 }
 
-void heapUpdate(struct point_t *p)
+/* p's cost changed, move it up or down in place */
+void heapUpdate(int p)
 {
-   heapRemove(p);
-   heapInsert(p);
+   trace(HEAP_TRACE_UPDATE, p);
+#ifdef DEBUG
+   if(PointIndex[p] >= heapSize)
+      die("cannot update a point not in the heap\n");
+#endif
+
+   int o = PointIndex[p];
+   mfloat cost = PointCost[p];
+   if(o > 0 && cost < HeapCost[parent(o)])
+      siftup(o, p, cost);
+   else
+      siftdown(o, p, cost);
 }
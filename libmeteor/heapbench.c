@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2007  Sean D'Epagnier   All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* this program times the heap on the operations of a real merge.  Build
+   the library with -DHEAP_TRACE, run a merge to get heap.trace, then
+   run heapbench heap.trace.  The trace is replayed on heap.c and on
+   the binary heap it replaced, which read costs through PointCost */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "heap.c"
+
+mfloat *PointCost;
+int *PointIndex;
+unsigned int CreatedPoints, FreedPoints;
+
+/* the binary heap heap.c replaced */
+static int *OldHeap, *OldIndex, oldSize;
+
+static inline int oldparent(int a) {
+   return  (a-!(a&1)) >> 1;
+}
+
+static inline int oldchild(int a) {
+   return (a<<1) + 1;
+}
+
+static void oldInsert(int p) {
+   int n = oldSize++;
+
+   for(;;) {
+      int o = oldparent(n);
+      if(n == 0 || PointCost[OldHeap[o]] <= PointCost[p]) {
+         OldIndex[p] = n;
+         OldHeap[n] = p;
+         break;
+      }
+
+      OldHeap[n] = OldHeap[o];
+      OldIndex[OldHeap[n]] = n;
+      n = o;
+   }
+}
+
+#define min(x, y) (x < y ? x : y)
+
+static void oldRemove(int p)
+{
+   int c, o;
+
+   oldSize--;
+
+   o = OldIndex[p];
+   c = oldchild(o);
+   while(c < oldSize && min(PointCost[OldHeap[c]], PointCost[OldHeap[c+1]])
+         < PointCost[OldHeap[oldSize]]) {
+      if(PointCost[OldHeap[c]] > PointCost[OldHeap[c+1]])
+         c++;
+
+      OldHeap[o] = OldHeap[c];
+      OldIndex[OldHeap[o]] = o;
+
+      o = c;
+      c = oldchild(c);
+   }
+
+   int par = oldparent(o);
+   while(o > 0 && PointCost[OldHeap[par]] > PointCost[OldHeap[oldSize]]) {
+      OldHeap[o] = OldHeap[par];
+      OldIndex[OldHeap[o]] = o;
+
+      o = par;
+      par = oldparent(par);
+   }
+
+   OldHeap[o] = OldHeap[oldSize];
+   OldIndex[OldHeap[o]] = o;
+}
+
+static void oldUpdate(int p)
+{
+   oldRemove(p);
+   oldInsert(p);
+}
+
+static struct heaptrace *Trace;
+static int TraceCount, MaxPoint;
+
+static double gettime(void)
+{
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void reset(void)
+{
+   int i;
+   for(i = 0; i <= MaxPoint; i++)
+      PointIndex[i] = OldIndex[i] = -1;
+   heapSize = oldSize = 0;
+}
+
+/* the points given to heapInsertUnsorted wait outside the heap, and
+   operations on them are skipped */
+static inline int inheap(int p, int *index, int size)
+{
+   return index[p] >= 0 && index[p] < size;
+}
+
+static void replaynew(void)
+{
+   int i;
+   for(i = 0; i < TraceCount; i++) {
+      struct heaptrace *t = Trace + i;
+      PointCost[t->p] = t->cost;
+      switch(t->op) {
+      case HEAP_TRACE_INSERT: heapInsert(t->p); break;
+      case HEAP_TRACE_REMOVE:
+         if(inheap(t->p, PointIndex, heapSize))
+            heapRemove(t->p);
+         break;
+      case HEAP_TRACE_UPDATE:
+         if(inheap(t->p, PointIndex, heapSize))
+            heapUpdate(t->p);
+         break;
+      }
+   }
+}
+
+static void replayold(void)
+{
+   int i;
+   for(i = 0; i < TraceCount; i++) {
+      struct heaptrace *t = Trace + i;
+      PointCost[t->p] = t->cost;
+      switch(t->op) {
+      case HEAP_TRACE_INSERT: oldInsert(t->p); break;
+      case HEAP_TRACE_REMOVE:
+         if(inheap(t->p, OldIndex, oldSize))
+            oldRemove(t->p);
+         break;
+      case HEAP_TRACE_UPDATE:
+         if(inheap(t->p, OldIndex, oldSize))
+            oldUpdate(t->p);
+         break;
+      }
+   }
+}
+
+/* replay on both heaps at once, the least cost must always agree */
+static void check(void)
+{
+   int i;
+   reset();
+   for(i = 0; i < TraceCount; i++) {
+      struct heaptrace *t = Trace + i;
+      PointCost[t->p] = t->cost;
+      switch(t->op) {
+      case HEAP_TRACE_INSERT: heapInsert(t->p); oldInsert(t->p); break;
+      case HEAP_TRACE_REMOVE:
+         if(inheap(t->p, PointIndex, heapSize))
+            heapRemove(t->p), oldRemove(t->p);
+         break;
+      case HEAP_TRACE_UPDATE:
+         if(inheap(t->p, PointIndex, heapSize))
+            heapUpdate(t->p), oldUpdate(t->p);
+         break;
+      }
+      if(heapSize != oldSize
+         || (heapSize && HeapCost[0] != PointCost[OldHeap[0]])) {
+         fprintf(stderr, "heaps disagree at operation %d\n", i);
+         exit(1);
+      }
+   }
+}
+
+int main(int argc, char **argv)
+{
+   if(argc != 2) {
+      fprintf(stderr, "usage: heapbench TRACE\n");
+      return 1;
+   }
+
+   FILE *file = fopen(argv[1], "rb");
+   if(!file) {
+      perror(argv[1]);
+      return 1;
+   }
+
+   int slots = 0;
+   struct heaptrace t;
+   while(fread(&t, sizeof t, 1, file) == 1) {
+      if(TraceCount == slots) {
+         slots = slots ? 2 * slots : 1024;
+         Trace = realloc(Trace, slots * sizeof *Trace);
+      }
+      Trace[TraceCount++] = t;
+      if(t.p > MaxPoint)
+         MaxPoint = t.p;
+   }
+   fclose(file);
+
+   int n = MaxPoint + 1;
+   PointCost = malloc(n * sizeof *PointCost);
+   PointIndex = malloc(n * sizeof *PointIndex);
+   Heap = malloc(n * sizeof *Heap);
+   HeapCost = malloc(n * sizeof *HeapCost);
+   OldIndex = malloc(n * sizeof *OldIndex);
+   OldHeap = malloc(n * sizeof *OldHeap);
+
+   check();
+   printf("%d operations on %d points\n", TraceCount, n);
+
+   /* take the best of a few runs of each */
+   double best[2] = {1.0/0.0, 1.0/0.0};
+   int run;
+   for(run = 0; run < 5; run++) {
+      double time;
+      reset();
+      time = gettime();
+      replayold();
+      time = gettime() - time;
+      if(time < best[0])
+         best[0] = time;
+
+      reset();
+      time = gettime();
+      replaynew();
+      time = gettime() - time;
+      if(time < best[1])
+         best[1] = time;
+   }
+
+   printf("binary heap through PointCost: %f seconds\n", best[0]);
+   printf("4-ary heap with HeapCost:      %f seconds (%.2fx)\n",
+          best[1], best[0] / best[1]);
+   return 0;
+}
@@ -33,53 +33,84 @@ typedef long double mfloat;
 #error "no type selected"
 #endif
 
-struct tri_t;
+/* The mesh is kept in arrays indexed by point and triangle number instead
+   of structures linked by pointers.  Each part of a point has its own array,
+   so a pass that only needs the positions or the costs doesn't pull the rest
+   through the cache.  Point 0 and triangle 0 are never used so 0 can mean
+   none, triangle 0 is the head of the circular list of triangles.
 
-struct trilist_t {
-   struct tri_t *tri;
-   struct trilist_t *next;
-};
+   Corner c is point c%3 of triangle c/3.  Each point's corners are a ring
+   linked both ways through CornerNext and CornerPrev (ending with 0), so
+   going around a point, and taking a corner off it, don't need a search.
+   The corners after and before c in its triangle are found from c alone,
+   the pair of c and nextcorner(c) names the directed edge between them. */
 
-struct point_t {
-   mfloat pos[3];
-
-   /* the Q matrix is used for quadric merging, the kd members
-      are used in the kd tree which does not use the cost matrix */
-   union {
-      mfloat Q[10]; /* cost matrix */ 
-      struct {
-         struct point_t *kdl, *kdr, **kdp;
-         int kdaxis; /* depth in kd-tree */
-      };
+/* the Q matrix is used for quadric merging, the kd members
+   are used in the kd tree which does not use the cost matrix */
+union pointq {
+   mfloat Q[10]; /* cost matrix */
+   struct {
+      int kdl, kdr, kdparent;
+      int kdaxis; /* depth in kd-tree */
    };
- 
-   struct trilist_t *tris;
+};
 
-   union {
-      mfloat cost; /* cost of making the merge */
-      mfloat cut; /* used for cutting */
-   };
+/* positions and extra data (normal, texture, color) are stored as float
+   when FloatStorage is set, otherwise as mfloat, use the accessors below */
+extern void *PointPos, *PointData;
+extern int FloatStorage;
+extern union pointq *PointQ;
 
-   int index; /* index back into heap */
-   union {
-      struct point_t *mp; /* least cost point to merge to */
-      struct point_t *next; /* when in a linked list */
-   };
+/* cost of making the merge, or used for cutting */
+extern mfloat *PointCost;
+#define PointCut PointCost
 
-   /* extra data (normal, texture, color) */
-   mfloat data[];
-};
+extern int *PointIndex; /* index back into heap, -1 once freed */
 
-struct tri_t {
-   struct tri_t *prev, *next;
-   struct point_t *p[3]; /* our points */
-};
+/* least cost point to merge to (signed, and 0 once it has to be worked
+   out again for quadric merging, see mesh.c), the next free point, or
+   while streaming the index given to the stream sink (-1 until sent) */
+extern int *PointLink;
+#define PointStream PointLink
+
+extern int *PointCorner; /* first corner of the point's triangles */
+
+extern int *Corners; /* the 3 points of each triangle */
+extern int *CornerNext, *CornerPrev;
+extern int *TriNext, *TriPrev; /* TriPrev is -1 once the triangle is freed */
+
+static inline int nextcorner(int c)
+{
+   return c % 3 == 2 ? c - 2 : c + 1;
+}
+
+static inline int prevcorner(int c)
+{
+   return c % 3 ? c - 1 : c + 2;
+}
+
+/* start loading the memory at a into the cache before it is needed.
+   Walking corner rings mostly waits on memory, one point at a time */
+#ifdef __GNUC__
+#define prefetch(a) __builtin_prefetch(a)
+#else
+#define prefetch(a) ((void)(a))
+#endif
 
 /* meteor routines */
 void CalculateHeap(int start, int end);
-void addToTriList(struct point_t *p, struct tri_t *q);
+void addCorner(int c);
+void removeCorner(int c);
+void replaceCorner(int c, int n);
 
-extern void (*CalculateOptimalPoint)(struct point_t *p, int init);
+void QuadricPoint(int p, mfloat penalty);
+
+/* the cost of contracting a point with quadric q with each of the n points
+   in nb, using the kernel picked by QuadricKernel */
+extern void (*QuadricCosts)(const mfloat *q, const int *nb, int n,
+                            mfloat *costs);
+enum {QUADRIC_SCALAR, QUADRIC_SSE2, QUADRIC_AVX2};
+int QuadricKernel(int kernel);
 
 extern unsigned int CreatedPoints, FreedPoints;
 extern unsigned int CreatedTriangles, FreedTriangles;
@@ -91,20 +122,95 @@ extern unsigned int SortedTriangleCount;
 extern int DataFormat;
 extern int NormalOffset, ColorOffset, TexCoordOffset;
 
+/* most points passed to FuncBatch at once */
+#define FUNC_BATCH 256
+
 /* a means to fatally abort */
 #define die(...) (fflush(stdout), fprintf(stderr, "[libmeteor] "__VA_ARGS__), abort())
 
 /* mem */
 extern int DataParts;
 
-extern struct tri_t *Tris;
+/* most extra data per point, a triple each of normal, color and texcoord */
+#define MAX_DATA 9
+
+/* the stored values are always worked on as mfloat, these copy them
+   in and out of whichever type meteorStorage picked */
+static inline mfloat getcoord(int p, int axis)
+{
+   if(FloatStorage)
+      return ((float (*)[3])PointPos)[p][axis];
+   return ((mfloat (*)[3])PointPos)[p][axis];
+}
+
+static inline void loadpos(mfloat pos[3], int p)
+{
+   int i;
+   if(FloatStorage)
+      for(i = 0; i < 3; i++)
+         pos[i] = ((float (*)[3])PointPos)[p][i];
+   else
+      for(i = 0; i < 3; i++)
+         pos[i] = ((mfloat (*)[3])PointPos)[p][i];
+}
+
+static inline void storepos(int p, const mfloat pos[3])
+{
+   int i;
+   if(FloatStorage)
+      for(i = 0; i < 3; i++)
+         ((float (*)[3])PointPos)[p][i] = pos[i];
+   else
+      for(i = 0; i < 3; i++)
+         ((mfloat (*)[3])PointPos)[p][i] = pos[i];
+}
+
+static inline mfloat getdata(int p, int i)
+{
+   if(FloatStorage)
+      return ((float *)PointData)[3 * DataParts * p + i];
+   return ((mfloat *)PointData)[3 * DataParts * p + i];
+}
 
-struct point_t *AllocPoint(void);
-void FreeTriList(struct point_t *p);
-void FreeTriListItem(struct trilist_t **l);
-void FreeTri(struct tri_t *t);
-struct trilist_t *AllocTriList(void);
-struct tri_t *AllocTri(void);
+static inline void setdata(int p, int i, mfloat value)
+{
+   if(FloatStorage)
+      ((float *)PointData)[3 * DataParts * p + i] = value;
+   else
+      ((mfloat *)PointData)[3 * DataParts * p + i] = value;
+}
+
+/* all 3 * DataParts values of a point */
+static inline void loaddata(mfloat *data, int p)
+{
+   int i, n = 3 * DataParts;
+   if(FloatStorage)
+      for(i = 0; i < n; i++)
+         data[i] = ((float *)PointData)[n * p + i];
+   else
+      for(i = 0; i < n; i++)
+         data[i] = ((mfloat *)PointData)[n * p + i];
+}
+
+static inline void storedata(int p, const mfloat *data)
+{
+   int i, n = 3 * DataParts;
+   if(FloatStorage)
+      for(i = 0; i < n; i++)
+         ((float *)PointData)[n * p + i] = data[i];
+   else
+      for(i = 0; i < n; i++)
+         ((mfloat *)PointData)[n * p + i] = data[i];
+}
+
+extern int LastTri; /* first triangle made by the last build */
+
+extern int PointSlots; /* size of the point arrays */
+
+int AllocPoint(void);
+void FreePoint(int p);
+void FreeTri(int t);
+int AllocTri(void);
 
 void freeTris(void);
 void freeMem(void);
@@ -116,31 +222,90 @@ extern int MeshModified;
 
 /* heap */
 enum {HEAP_NONE, HEAP_MIN, HEAP_AGGREGATE};
-extern struct point_t **Heap;
+extern int *Heap;
+extern mfloat *HeapCost;
 extern int heapSize, heapMode;
 
-void heapInsert(struct point_t *p);
-void heapInsertUnsorted(struct point_t *p);
-void heapRemove(struct point_t *p);
-void heapUpdate(struct point_t *p);
+/* children of position h in Heap are HEAP_ARITY*h + 1 and the ones after */
+#define HEAP_ARITY 4
+
+/* an operation recorded with HEAP_TRACE */
+enum {HEAP_TRACE_UNSORTED, HEAP_TRACE_INSERT, HEAP_TRACE_REMOVE,
+      HEAP_TRACE_UPDATE};
+struct heaptrace {
+   int op, p;
+   double cost; /* PointCost[p] when the operation was done */
+};
+
+void heapInsert(int p);
+void heapInsertUnsorted(int p);
+void heapRemove(int p);
+void heapUpdate(int p);
 void heapClear(void);
 void heapSetSize(int s);
 
 /* kd tree for aggregation */
-void kdTreeInsert(struct point_t *p);
-void kdTreeRemove(struct point_t *p);
-void kdTreeUpdate(struct point_t *p);
-void kdTreeClear(void);
+void kdTreeInsert(int p);
+void kdTreeRemove(int p);
+void kdTreeUpdate(int p);
+void kdTreeBuild(void);
+void kdTreeBalance(void);
+
+/* hash table keyed by integers */
+union hashitem {
+   int point;
+   mfloat val;
+};
+
+struct hashtable {
+   int size, count;
+   long long *keys;
+   union hashitem *items;
+};
+
+union hashitem *hashFind(struct hashtable *h, long long key);
+union hashitem *hashInsert(struct hashtable *h, long long key, int *found);
+void hashFree(struct hashtable *h);
+
+/* progressive meshes */
+extern int Progressive;
+void progressiveStart(void);
+void progressiveMerge(int p1, int p2);
+void progressiveRemove(int tri);
+void progressiveStale(void);
+void progressiveFree(void);
+
+/* threads */
+extern int ThreadCount;
+void ParallelRun(int count, void (*func)(int, void *), void *arg);
 
 /* building */
-void AddQTri(struct tri_t *tri);
+void TriQuadric(int tri, mfloat q[10]);
+void AddQTri(int tri);
 void buildQHeap(void);
-void NewTriangle(struct point_t *p1, struct point_t *p2, struct point_t *p3);
-struct point_t *NewPoint(void);
+void NewTriangle(int p1, int p2, int p3);
+int NewPoint(void);
+
+/* transformations waiting to be applied to the points, see matrix.c */
+extern int TransformPending;
+void ApplyTransform(void);
+void ClearTransform(void);
+
+extern int LazyData, DataStale;
+void UpdateData(void);
+void UpdatePointData(int p);
 
 double (*Func)(double, double, double);
+extern void (*FuncBatch)(double *, const double *, const double *, const double *, int);
 void (*NormalFunc)(double[3], double[3]);
 void (*ColorFunc)(double[3], double[3]);
 void (*TexCoordFunc)(double[3], double[3]);
+extern void (*GradientFunc)(double[3], double[3]);
+
+/* how the crossing of the surface along an edge is found, and
+   counts of the function evaluations used to report the average */
+extern int RefineMethod, RefineIterations;
+extern double RefineTolerance;
+extern long long RefineEdges, RefineEvaluations;
 
 #pragma GCC visibility pop
@@ -20,8 +20,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "internal.h"
+#include "meteor.h"
 
 #include "linalg.h"
 
@@ -29,106 +31,225 @@
                      higher for more error and speed */
 #define INF (1.0 / 0.0)
 
-static struct point_t *kdTree; /* head of tree */
+/* points given to each thread at a time while finding nearest neighbors */
+#define KD_CHUNK 1024
+
+static int kdTree; /* head of tree */
+
+/* points taken out since the tree was last built, the tree is built again
+   once this passes the number of points left so it stays balanced */
+static int kdRemoved;
 
 static const int nextaxis[] = {1, 2, 0};
 
+/* the link in the tree that leads to p */
+static inline int *kdlink(int p)
+{
+   int parent = PointQ[p].kdparent;
+   if(!parent)
+      return &kdTree;
+   return PointQ[parent].kdl == p ? &PointQ[parent].kdl : &PointQ[parent].kdr;
+}
+
 /* insert a point and find another point that is closest to it,
    if ins is 0, then it is already inserted and looking for other points
-   to see if they are closer than the current minimum */
-static void insertrec(struct point_t *p, struct point_t **n, int axis, int ins)
+   to see if they are closer than the current minimum, pos is p's position.
+   m is compared before its subtrees so the closest distance so far cuts
+   off as much of them as it can */
+static void insertrec(int p, mfloat pos[3], int parent, int *n, int axis,
+                      int ins)
 {
-   struct point_t *m = *n;
+   int m = *n;
    if(!m) {
       if(ins) {
-         p->cost = INF;
          *n = p;
-         p->kdaxis = axis;
-         p->kdl = p->kdr = NULL;
-         p->kdp = n;
+         PointQ[p].kdaxis = axis;
+         PointQ[p].kdl = PointQ[p].kdr = 0;
+         PointQ[p].kdparent = parent;
       }
       return;
    }
 
-   mfloat dist = p->pos[axis] - m->pos[axis];
+   if(m != p) {
+      mfloat mpos[3];
+      loadpos(mpos, m);
+      mfloat d = dist2(pos, mpos);
+      if(d < PointCost[p]) {
+         PointCost[p] = d;
+         PointLink[p] = m;
+      }
+   }
+
+   mfloat dist = pos[axis] - getcoord(m, axis);
    mfloat dist_2 = dist*dist*DELTA;
    int naxis = nextaxis[axis];
    if(dist < 0) {
-      insertrec(p, &m->kdl, naxis, ins);
-      if(p->cost < dist_2)
+      insertrec(p, pos, m, &PointQ[m].kdl, naxis, ins);
+      if(PointCost[p] < dist_2)
          return;
-      insertrec(p, &m->kdr, naxis, 0);
+      insertrec(p, pos, m, &PointQ[m].kdr, naxis, 0);
    } else {
-      insertrec(p, &m->kdr, naxis, ins);
-      if(p->cost < dist_2)
+      insertrec(p, pos, m, &PointQ[m].kdr, naxis, ins);
+      if(PointCost[p] < dist_2)
          return;
-      insertrec(p, &m->kdl, naxis, 0);
-   }
-   
-   dist = dist2(p->pos, m->pos);
-   if(dist < p->cost) {
-      p->cost = dist;
-      p->mp = m;
+      insertrec(p, pos, m, &PointQ[m].kdl, naxis, 0);
    }
 }
 
 /* put a point in the kdtree, and update the point's cost
-   and mp to the closest point to it in the tree */
-void kdTreeInsert(struct point_t *p)
+   and link to the closest point to it in the tree */
+void kdTreeInsert(int p)
 {
-   insertrec(p, &kdTree, 0, 1);
+   mfloat pos[3];
+   loadpos(pos, p);
+   PointCost[p] = INF;
+   insertrec(p, pos, 0, &kdTree, 0, 1);
 }
 
-struct point_t *findmin(struct point_t *p, int axis)
+static int findmin(int p, int axis)
 {
    if(!p)
-      return NULL;
-   struct point_t *q = findmin(p->kdl, axis);
-   if(p->kdaxis != axis) {
-      struct point_t *r = findmin(p->kdr, axis);
-      if(!q || (r && r->pos[axis] < q->pos[axis]))
+      return 0;
+   int q = findmin(PointQ[p].kdl, axis);
+   if(PointQ[p].kdaxis != axis) {
+      int r = findmin(PointQ[p].kdr, axis);
+      if(!q || (r && getcoord(r, axis) < getcoord(q, axis)))
          q = r;
    }
 
-   if(!q || p->pos[axis] < q->pos[axis])
+   if(!q || getcoord(p, axis) < getcoord(q, axis))
       return p;
    return q;
 }
 
 /* pull a point out of the kd tree */
-void kdTreeRemove(struct point_t *p)
+static void removenode(int p)
 {
-   if(!p->kdr) {
-      if(!p->kdl) {
-         *p->kdp = NULL;
+   union pointq *k = PointQ + p;
+   if(!k->kdr) {
+      if(!k->kdl) {
+         *kdlink(p) = 0;
          return;
       }
-      p->kdr = p->kdl;
-      p->kdr->kdp = &p->kdr;
-      p->kdl = NULL;
+      k->kdr = k->kdl;
+      k->kdl = 0;
    }
 
-   struct point_t *q = findmin(p->kdr, p->kdaxis);
-   kdTreeRemove(q);
-   q->kdaxis = p->kdaxis;
-   q->kdl = p->kdl;
-   q->kdr = p->kdr;
-   q->kdp = p->kdp;
-
-   *q->kdp = q;
-   if(q->kdl)
-      q->kdl->kdp = &q->kdl;
-   if(q->kdr)
-      q->kdr->kdp = &q->kdr;
+   int q = findmin(k->kdr, k->kdaxis);
+   removenode(q);
+
+   union pointq *kq = PointQ + q;
+   *kdlink(p) = q;
+   kq->kdaxis = k->kdaxis;
+   kq->kdl = k->kdl;
+   kq->kdr = k->kdr;
+   kq->kdparent = k->kdparent;
+
+   if(kq->kdl)
+      PointQ[kq->kdl].kdparent = q;
+   if(kq->kdr)
+      PointQ[kq->kdr].kdparent = q;
+}
+
+void kdTreeRemove(int p)
+{
+   removenode(p);
+   kdRemoved++;
 }
 
-void kdTreeUpdate(struct point_t *p)
+void kdTreeUpdate(int p)
 {
    kdTreeRemove(p);
    kdTreeInsert(p);
 }
 
-void kdTreeClear(void)
+/* put the median of the n points along axis in the middle, with the ones
+   below it before it and the rest after it */
+static void median(int *points, int n, int axis)
+{
+   int lo = 0, hi = n - 1, mid = n / 2;
+   while(lo < hi) {
+      mfloat pivot = getcoord(points[(lo + hi) / 2], axis);
+      int i = lo, j = hi;
+      while(i <= j) {
+         while(getcoord(points[i], axis) < pivot)
+            i++;
+         while(getcoord(points[j], axis) > pivot)
+            j--;
+         if(i <= j) {
+            int t = points[i];
+            points[i++] = points[j];
+            points[j--] = t;
+         }
+      }
+      if(mid <= j)
+         hi = j;
+      else if(mid >= i)
+         lo = i;
+      else
+         break;
+   }
+}
+
+/* make a subtree of the n points split at the median along axis, and
+   return its root */
+static int buildrec(int *points, int n, int parent, int axis)
+{
+   if(!n)
+      return 0;
+
+   median(points, n, axis);
+   int mid = n / 2, m = points[mid], naxis = nextaxis[axis];
+   PointQ[m].kdaxis = axis;
+   PointQ[m].kdparent = parent;
+   PointQ[m].kdl = buildrec(points, mid, m, naxis);
+   PointQ[m].kdr = buildrec(points + mid + 1, n - mid - 1, m, naxis);
+   return m;
+}
+
+/* build the tree over the points in the heap */
+static void build(void)
+{
+   int *points = malloc(heapSize * sizeof *points);
+   if(!points)
+      die("failed to allocate memory for kd tree\n");
+
+   memcpy(points, Heap, heapSize * sizeof *points);
+   kdTree = buildrec(points, heapSize, 0, 0);
+   kdRemoved = 0;
+   free(points);
+}
+
+/* the tree is only read here, and each point only writes its own
+   cost and link */
+static void nearestworker(int i, void *arg)
+{
+   int j, end = (i + 1) * KD_CHUNK;
+   if(end > heapSize)
+      end = heapSize;
+   for(j = i * KD_CHUNK; j < end; j++) {
+      int p = Heap[j];
+      mfloat pos[3];
+      loadpos(pos, p);
+      PointCost[p] = INF;
+      insertrec(p, pos, 0, &kdTree, 0, 0);
+   }
+}
+
+/* Put all the points in the heap in the tree at once, and find the
+   closest other point to each.  Inserting them one at a time in the order
+   they were made (which follows the surface) makes a lopsided tree, and
+   each point would only be compared to the ones before it. */
+void kdTreeBuild(void)
+{
+   build();
+   ParallelRun((heapSize + KD_CHUNK - 1) / KD_CHUNK, nearestworker, NULL);
+}
+
+/* build the tree again if many points came out of it since it was built,
+   the points keep their costs and links */
+void kdTreeBalance(void)
 {
-   kdTree = NULL;
+   if(kdRemoved > heapSize)
+      build();
 }
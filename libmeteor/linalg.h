@@ -214,20 +214,74 @@ static inline void lininterpolate3(mfloat x[3], mfloat a[3], mfloat b[3], mfloat
    x[2] = a[2] + pos*(b[2] - a[2]);
 }
 
-/* iteratively improve the location of the point */
-static inline void iterativeimprove(mfloat pos[3], mfloat q1[4], mfloat q2[4],
-                                    double func(double, double, double))
-{
-   int i;
-   for(i = 0;; i++) {
-      lininterpolate3(pos, q1, q2, fabs(q1[3]) / fabs(q1[3] - q2[3]));
-      if(i == 5) /* it gets pretty damn close at 5 */
-	 break;
+/* the first guess, or the next one if there is no newton step,
+   is where the line between the ends of the bracket crosses zero */
+static inline void refinepoint(mfloat pos[3], mfloat q1[4], mfloat q2[4])
+{
+   lininterpolate3(pos, q1, q2, fabs(q1[3]) / fabs(q1[3] - q2[3]));
+}
+
+/* replace the end of the bracket with the same sign as v, the value at pos.
+   last is the end replaced the previous time, if it is replaced again the
+   illinois method halves the value at the other end so it gets moved too */
+static inline void refineupdate(mfloat pos[3], mfloat v, mfloat q1[4],
+                                mfloat q2[4], int *last)
+{
+   if(v * q1[3] >= 0) {
+      q1[0] = pos[0], q1[1] = pos[1], q1[2] = pos[2], q1[3] = v;
+      if(RefineMethod == METEOR_REFINE_ILLINOIS && *last == 1)
+         q2[3] /= 2;
+      *last = 1;
+   } else {
+      q2[0] = pos[0], q2[1] = pos[1], q2[2] = pos[2], q2[3] = v;
+      if(RefineMethod == METEOR_REFINE_ILLINOIS && *last == 2)
+         q1[3] /= 2;
+      *last = 2;
+   }
+}
+
+/* move pos with a newton step along the edge using the gradient there,
+   returns 0 (leaving pos alone) if the step would leave the bracket */
+static inline int newtonstep(mfloat pos[3], mfloat v, mfloat q1[4],
+                             mfloat q2[4], void grad(double[3], double[3]))
+{
+   double g[3], p[3] = {pos[0], pos[1], pos[2]};
+   grad(g, p);
+
+   mfloat d[3], o[3];
+   sub3(d, q2, q1);
+   sub3(o, pos, q1);
+   mfloat gd = g[0]*d[0] + g[1]*d[1] + g[2]*d[2], dd = dot(d, d);
+   if(gd == 0 || dd == 0)
+      return 0;
+
+   mfloat t = dot(o, d) / dd - v / gd;
+   if(!(t > 0 && t < 1))
+      return 0;
+
+   lininterpolate3(pos, q1, q2, t);
+   return 1;
+}
+
+/* iteratively improve the location of the point where the surface crosses
+   the edge from q1 to q2, evaluating func at most RefineIterations times
+   (it gets pretty damn close at 5) or until the value is within
+   RefineTolerance.  If grad is given, newton steps are taken when they
+   stay inside the bracket.  Returns the number of evaluations */
+static inline int iterativeimprove(mfloat pos[3], mfloat q1[4], mfloat q2[4],
+                                   double func(double, double, double),
+                                   void grad(double[3], double[3]))
+{
+   int i, last = 0;
+   refinepoint(pos, q1, q2);
+   for(i = 0; i < RefineIterations; i++) {
       mfloat v = func(pos[0], pos[1], pos[2]);
+      if(fabs(v) <= RefineTolerance)
+         return i + 1;
 
-      if(v * q1[3] >= 0)
-	 q1[0] = pos[0], q1[1] = pos[1], q1[2] = pos[2], q1[3] = v;
-      else
-	 q2[0] = pos[0], q2[1] = pos[1], q2[2] = pos[2], q2[3] = v;
+      refineupdate(pos, v, q1, q2, &last);
+      if(!grad || !newtonstep(pos, v, q1, q2, grad))
+         refinepoint(pos, q1, q2);
    }
+   return i;
 }
@@ -16,6 +16,11 @@
  * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+/* Transformations are not applied to the points when they are asked for,
+   they are multiplied into a pending matrix, and the points and normals
+   are moved by it in one pass the next time anything uses them. */
+
+#include <string.h>
 #include <math.h>
 #include "meteor.h"
 #include "internal.h"
@@ -24,28 +29,136 @@
 
 #define DEG2RAD (M_PI / 180.0)
 
-void meteorMultMatrix(double m[16])
+/* points given to each thread at a time */
+#define TRANSFORM_CHUNK 1024
+
+int TransformPending;
+
+/* the transformations asked for since the last pass, in order */
+static double Pending[16] = {1, 0, 0, 0,
+                             0, 1, 0, 0,
+                             0, 0, 1, 0,
+                             0, 0, 0, 1};
+
+/* normals go by the inverse transpose of the upper 3x3 of Pending, so
+   they stay perpendicular to the surface under uneven scaling */
+static double Normal[9];
+
+/* with gcc each point is done as one vector per column of the matrix,
+   long double is left to the scalar version to keep its precision */
+#if defined(__GNUC__) && !defined(USE_LONG_DOUBLE_FORMAT)
+#define TRANSFORM_VECTOR
+typedef double v4d __attribute__((vector_size(32)));
+static v4d Columns[4], NormalColumns[3];
+#endif
+
+static void transformworker(int i, void *arg)
 {
-   int i;
-   for(i = 0; i<PointCount; i++) {
-      struct point_t *p = Heap[i];
-      mfloat v[3] = {p->pos[0], p->pos[1], p->pos[2]};
-      p->pos[0] = v[0]*m[0] + v[1]*m[1] + v[2]*m[2] + m[3];
-      p->pos[1] = v[0]*m[4] + v[1]*m[5] + v[2]*m[6] + m[7];
-      p->pos[2] = v[0]*m[8] + v[1]*m[9] + v[2]*m[10] + m[11];
-      //      p->pos[3] = v[0]*m[12] + v[1]*m[13] + v[2]*m[14] + v[3]*m[15];
-
-      /* update normal, but no translation, only rotation */
-      if(DataFormat & METEOR_NORMALS) {
-         mfloat *n = p->data+NormalOffset;
-         mfloat nv[3] = {n[0], n[1], n[2]};         
-         n[0] = nv[0]*m[0] + nv[1]*m[1] + nv[2]*m[2];
-         n[1] = nv[0]*m[4] + nv[1]*m[5] + nv[2]*m[6];
-         n[2] = nv[0]*m[8] + nv[1]*m[9] + nv[2]*m[10];
+   int j, k, end = (i + 1) * TRANSFORM_CHUNK;
+   if(end > PointCount)
+      end = PointCount;
+   int normals = DataFormat & METEOR_NORMALS;
+   for(j = i * TRANSFORM_CHUNK; j < end; j++) {
+      int p = Heap[j];
+      mfloat v[3];
+      loadpos(v, p);
+#ifdef TRANSFORM_VECTOR
+      v4d r = Columns[0]*v[0] + Columns[1]*v[1] + Columns[2]*v[2] + Columns[3];
+      for(k = 0; k < 3; k++)
+         v[k] = r[k];
+#else
+      mfloat pos[3];
+      for(k = 0; k < 3; k++)
+         pos[k] = v[0]*Pending[4*k] + v[1]*Pending[4*k + 1]
+            + v[2]*Pending[4*k + 2] + Pending[4*k + 3];
+      memcpy(v, pos, sizeof pos);
+#endif
+      storepos(p, v);
+
+      if(normals) {
+         mfloat data[MAX_DATA];
+         loaddata(data, p);
+         mfloat *n = data + NormalOffset, len = sqrt(dot(n, n));
+#ifdef TRANSFORM_VECTOR
+         r = NormalColumns[0]*n[0] + NormalColumns[1]*n[1]
+            + NormalColumns[2]*n[2];
+         for(k = 0; k < 3; k++)
+            n[k] = r[k];
+#else
+         mfloat nv[3] = {n[0], n[1], n[2]};
+         for(k = 0; k < 3; k++)
+            n[k] = nv[0]*Normal[3*k] + nv[1]*Normal[3*k + 1]
+               + nv[2]*Normal[3*k + 2];
+#endif
+         /* the normals keep their length, only turning */
+         mfloat newlen = sqrt(dot(n, n));
+         if(newlen > 0)
+            for(k = 0; k < 3; k++)
+               n[k] *= len / newlen;
+         storedata(p, data);
       }
    }
 }
 
+/* move the points and normals by the pending transformations */
+void ApplyTransform(void)
+{
+   /* the normals must be calculated where the points were */
+   if(DataStale)
+      UpdateData();
+
+   progressiveStale();
+
+   /* the cofactors are the inverse transpose times the determinant, the
+      sign is kept so a mirroring doesn't turn the normals inside out */
+   const double *m = Pending;
+   double c[9] = {m[5]*m[10] - m[6]*m[9], m[6]*m[8] - m[4]*m[10],
+                  m[4]*m[9] - m[5]*m[8], m[2]*m[9] - m[1]*m[10],
+                  m[0]*m[10] - m[2]*m[8], m[1]*m[8] - m[0]*m[9],
+                  m[1]*m[6] - m[2]*m[5], m[2]*m[4] - m[0]*m[6],
+                  m[0]*m[5] - m[1]*m[4]};
+   double det = m[0]*c[0] + m[1]*c[1] + m[2]*c[2];
+   int i, j;
+   for(i = 0; i < 9; i++)
+      Normal[i] = det < 0 ? -c[i] : c[i];
+
+#ifdef TRANSFORM_VECTOR
+   for(j = 0; j < 4; j++)
+      Columns[j] = (v4d){m[j], m[4 + j], m[8 + j], 0};
+   for(j = 0; j < 3; j++)
+      NormalColumns[j] = (v4d){Normal[j], Normal[3 + j], Normal[6 + j], 0};
+#endif
+
+   ParallelRun((PointCount + TRANSFORM_CHUNK - 1) / TRANSFORM_CHUNK,
+               transformworker, NULL);
+
+   ClearTransform();
+}
+
+/* forget the pending transformations, there are no points for them */
+void ClearTransform(void)
+{
+   int i;
+   for(i = 0; i < 16; i++)
+      Pending[i] = i % 5 == 0;
+   TransformPending = 0;
+}
+
+/* m is put after the transformations already pending */
+void meteorMultMatrix(double m[16])
+{
+   double r[16];
+   int i, j, k;
+   for(i = 0; i < 4; i++)
+      for(j = 0; j < 4; j++) {
+         r[4*i + j] = 0;
+         for(k = 0; k < 4; k++)
+            r[4*i + j] += m[4*i + k] * Pending[4*k + j];
+      }
+   memcpy(Pending, r, sizeof r);
+   TransformPending = 1;
+}
+
 /* code came from mesa */
 void meteorRotate(double angle, double x, double y, double z)
 {
@@ -17,9 +17,8 @@
  */
 
 /* This file contains routines for allocating the meteor data structure.
-   It can use libgc and GC_malloc if supported, or it will keep free
-   lists when items are freed, and use malloc when the freelist is
-   empty to allocate */
+   The points and triangles are slots in arrays which grow as needed, freed
+   slots are kept in free lists and used again before the arrays grow */
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,184 +26,170 @@
 
 int DataParts; /* number of additional triples of data per point */
 
-#ifdef HAVE_LIBGC
-#include <gc.h>
-#else
-/* different size points */
-static struct point_t *FreePoints[4];
+void *PointPos, *PointData;
+int FloatStorage; /* set by meteorReset, see meteorStorage */
+union pointq *PointQ;
+mfloat *PointCost;
+int *PointIndex, *PointLink, *PointCorner;
 
-static struct trilist_t *FreeTriLists;
-static struct tri_t *FreeTris;
-#endif
+/* slots allocated, slots used so far, and the first free one */
+int PointSlots;
+static int PointsUsed = 1, FreePoints;
+/* DataParts and FloatStorage when PointPos and PointData were allocated */
+static int PointDataParts, PointFloat;
 
-void FreeTriList(struct point_t *p)
+/* triangle 0 is the head of the list, before anything is
+   allocated it is kept here */
+static int TriHead[2];
+
+int *Corners, *CornerNext, *CornerPrev;
+int *TriNext = TriHead, *TriPrev = TriHead + 1;
+
+static int TriSlots, TrisUsed = 1, FreeTris;
+
+#define GROW(a, n) a = realloc(a, (n) * sizeof *a)
+
+static void growpoints(int slots)
 {
-#ifndef HAVE_LIBGC
-   /* get tail pointer */
-   struct trilist_t **l;
-   for(l = &p->tris; *l; l = &(*l)->next);    /* this makes things slow */
-   *l = FreeTriLists;
-   FreeTriLists = p->tris;
-   p->tris = NULL;
-#endif
+   size_t size = FloatStorage ? sizeof(float) : sizeof(mfloat);
+
+   PointSlots = slots;
+   PointPos = realloc(PointPos, 3 * PointSlots * size);
+   GROW(PointQ, PointSlots);
+   GROW(PointCost, PointSlots);
+   GROW(PointIndex, PointSlots);
+   GROW(PointLink, PointSlots);
+   GROW(PointCorner, PointSlots);
+   PointData = realloc(PointData, (3 * DataParts * PointSlots + 1) * size);
+   PointDataParts = DataParts;
+   PointFloat = FloatStorage;
 }
 
-void FreeTri(struct tri_t *tri)
+static void growtris(void)
 {
-   tri->prev->next = tri->next;
-   tri->next->prev = tri->prev;
-#ifndef HAVE_LIBGC
-   tri->next = FreeTris;
-   FreeTris = tri;
-#endif
-   FreedTriangles++;
+   if(!TriSlots) {
+      TriSlots = 1024;
+      TriNext = malloc(TriSlots * sizeof *TriNext);
+      TriPrev = malloc(TriSlots * sizeof *TriPrev);
+      TriNext[0] = TriHead[0];
+      TriPrev[0] = TriHead[1];
+   } else {
+      TriSlots *= 2;
+      GROW(TriNext, TriSlots);
+      GROW(TriPrev, TriSlots);
+   }
+   GROW(Corners, 3 * TriSlots);
+   GROW(CornerNext, 3 * TriSlots);
+   GROW(CornerPrev, 3 * TriSlots);
 }
 
-/* remove item at *l, if this empties a circular list, *l points to NULL */
-void FreeTriListItem(struct trilist_t **l)
+void FreeTri(int tri)
 {
-   struct trilist_t *m = *l;
-   *l = m->next;
-#ifndef HAVE_LIBGC
-   m->next = FreeTriLists;
-   FreeTriLists = m;
-#endif
+   /* merging between builds can remove new triangles */
+   if(tri == LastTri)
+      LastTri = TriNext[tri];
+
+   TriNext[TriPrev[tri]] = TriNext[tri];
+   TriPrev[TriNext[tri]] = TriPrev[tri];
+   TriNext[tri] = FreeTris;
+   TriPrev[tri] = -1;
+   FreeTris = tri;
+   FreedTriangles++;
 }
 
-void FreePoint(struct point_t *t)
+void FreePoint(int p)
 {
-#ifndef HAVE_LIBGC
-   t->next = FreePoints[DataParts];
-   FreePoints[DataParts] = t;
-#endif
-   t->index = -1; // checks this for points not in the heap for aggregation
+   PointLink[p] = FreePoints;
+   FreePoints = p;
+   PointIndex[p] = -1; // checks this for points not in the heap for aggregation
    FreedPoints++;
 }
 
-struct point_t *AllocPoint(void)
+int AllocPoint(void)
 {
-   struct point_t *p;
-   unsigned int size = sizeof(*p) + 3 * DataParts * sizeof(*p->data);
-#ifdef HAVE_LIBGC
-   p = GC_malloc(size);
-#else
-   if(FreePoints[DataParts]) {
-      p = FreePoints[DataParts];
-      FreePoints[DataParts] = p->next;
-   } else
-      p = malloc(size);
-#endif
+   int p;
+   if(FreePoints) {
+      p = FreePoints;
+      FreePoints = PointLink[p];
+   } else {
+      if(PointsUsed >= PointSlots)
+         growpoints(PointSlots ? 2 * PointSlots : 1024);
+      else if(PointDataParts != DataParts || PointFloat != FloatStorage)
+         growpoints(PointSlots); /* meteorReset changed the format */
+      p = PointsUsed++;
+   }
    CreatedPoints++;
 
    return p;
 }
 
-struct trilist_t *AllocTriList(void)
+int AllocTri(void)
 {
-   struct trilist_t *l;
-#ifdef HAVE_LIBGC
-   l = GC_malloc(sizeof *l);
-#else
-   if(FreeTriLists) {
-      l = FreeTriLists;
-      FreeTriLists = l->next;
-   } else
-      l = malloc(sizeof *l);
-#endif
-
-   return l;
-}
-
-struct tri_t *AllocTri(void)
-{
-   struct tri_t *t;
-#ifdef HAVE_LIBGC
-   t = GC_malloc(sizeof *t);
-#else
+   int t;
    if(FreeTris) {
       t = FreeTris;
-      FreeTris = t->next;
-   } else
-      t = malloc(sizeof *t);
-
-#endif
+      FreeTris = TriNext[t];
+   } else {
+      if(TrisUsed >= TriSlots)
+         growtris();
+      t = TrisUsed++;
+   }
    CreatedTriangles++;
 
-   t->prev = Tris->prev;
-   t->next = Tris;
-   Tris->prev = t;
-   t->prev->next = t;
+   TriPrev[t] = TriPrev[0];
+   TriNext[t] = 0;
+   TriPrev[0] = t;
+   TriNext[TriPrev[t]] = t;
 
    return t;
 }
 
 void freePoints(void)
 {
-   if(!PointCount)
-      return;
-
-#ifndef HAVE_LIBGC
-   int i = 0;
-   for(;;) {
-      struct point_t *p = Heap[i];
-      FreeTriList(p);
-      if(i == PointCount - 1)
-         break;
-      p->next = Heap[i+1];
-      i++;
-   }
-   Heap[i]->next = FreePoints[DataParts];
-   FreePoints[DataParts] = Heap[0];
-#endif
+   PointsUsed = 1;
+   FreePoints = 0;
 
    heapSize = 0;
    heapMode = HEAP_NONE;
    CreatedPoints = FreedPoints = 0;
 }
 
-/* free all points, tris, and trilists in the meteor */
+/* free all points, tris, and corners in the meteor */
 void freeMem(void)
 {
    freePoints();
+   ClearTransform();
 
-#ifndef HAVE_LIBGC
-   if(Tris->prev != Tris) {
-      Tris->prev->next = FreeTris;
-      FreeTris = Tris->next;
-   }
-#endif
-
-   Tris->prev = Tris->next = Tris;
+   TrisUsed = 1;
+   FreeTris = 0;
+   TriNext[0] = TriPrev[0] = 0;
    CreatedTriangles = FreedTriangles = 0;
-
 }
 
 void relinquishMem(void)
 {
-#ifndef HAVE_LIBGC
-#define FREE_LIST(X, Y) while(X) Y = X, X = X->next, free(Y)
-   int i;
-   for(i = 0; i<4; i++) {
-      struct point_t *p = FreePoints[i], *q;
-      //      FREE_LIST(p, q);
-      int c;
-      while(p) {
-         q = p;
-         p = p->next;
-         free(q);
-         c++;
-         if(c > 2700)
-            c= 10000;
-      }
-      FreePoints[i] = NULL;
+   free(PointPos);
+   free(PointQ);
+   free(PointData);
+   free(PointCost);
+   free(PointIndex);
+   free(PointLink);
+   free(PointCorner);
+   PointPos = PointData = NULL;
+   PointQ = NULL;
+   PointCost = NULL;
+   PointIndex = PointLink = PointCorner = NULL;
+   PointSlots = PointDataParts = PointFloat = 0;
+
+   if(TriSlots) {
+      free(Corners);
+      free(CornerNext);
+      free(CornerPrev);
+      free(TriNext);
+      free(TriPrev);
+      Corners = CornerNext = CornerPrev = NULL;
+      TriNext = TriHead, TriPrev = TriHead + 1;
+      TriHead[0] = TriHead[1] = 0;
+      TriSlots = 0;
    }
-
-   struct trilist_t *l = FreeTriLists, *m;
-   FREE_LIST(l, m);
-   FreeTriLists = NULL;
-
-   struct tri_t *t = FreeTris, *s;
-   FREE_LIST(t, s);
-   FreeTris = NULL;
-#endif
 }
@@ -20,14 +20,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <sys/time.h>
 
 #include "internal.h"
 #include "meteor.h"
 #include "linalg.h"
 
 /* globals from this file */
-void (*CalculateOptimalPoint)(struct point_t *p, int init);
-
 unsigned int CreatedPoints, FreedPoints;
 unsigned int CreatedTriangles, FreedTriangles;
 unsigned int SortedTriangleCount;
@@ -35,408 +34,581 @@ unsigned int SortedTriangleCount;
 int DataFormat = METEOR_COORDS;
 int NormalOffset, ColorOffset, TexCoordOffset;
 
-static struct tri_t header = {&header,&header};
-struct tri_t *Tris = &header;
-
-static inline mfloat CalculateQuadricContractionCost(mfloat q1[10], mfloat q2[10])
-{
-   mfloat A = q1[0]+q2[0], B = q1[1]+q2[1], C = q1[2]+q2[2];
-   mfloat D = q1[3]+q2[3], E = q1[4]+q2[4], F = q1[5]+q2[5];
-   mfloat G = q1[6]+q2[6], H = q1[7]+q2[7], I = q1[8]+q2[8];
-   mfloat J = q1[9]+q2[9];
-
-#if 1  /* use optimized version (see term-optimizer.scm) */
-   double t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
-    t0 = (B * I);
-    t1 = (C * G);
-    t2 = (D * F);
-    t3 = (A * F);
-    t4 = (B * H);
-    t5 = (C * E);
-    t6 = (A * E);
-    t7 = (-2 * D);
-    t8 = (2 * t0);
-    t9 = (((F * t3) + (-2 * B * C * F) + (B * t4) + (C * t5)) - (t6 * H));
-
-   if(t9 == 0)
-      return 1.0/0.0;
-
-    return (J*t9 + I*I*t6 + t3*-2*G*I + t8*t1 + t8*t2 + t7*t5*I + G*H*A*G
-            + t7*t4*G + D*H*D*E + t2*t1*2 - t0*t0 - t1*t1 - t2*t2) / t9;
-#else
-    /* unoptimized */
-    /* this is value for x where x=Q^-1*v*Q where Q = q1+q2.
-       v is the third column of R^-1 where R is Q with the last row
-       of 0 0 0 1 */
-    /* Solve[{a*x+b*y+c*z+d==0, b*x+e*y+f*z+g==0, c*x+f*y+h*z+i==0,
-       cost==x*x*a+y*y*e+z*z*h+j+2*(x*y*b+x*z*c+x*d+y*z*f+y*g+z*i)}, {x,y,z,cost}] */
-
-   mfloat denom = (C*C*E - 2*B*C*F + A*F*F + B*B*H - A*E*H);
-   if(denom == 0)
-      return 1.0/0.0;
-
-   return (-D*D*F*F + 2*C*D*F*G - C*C*G*G + D*D*E*H - 2*B*D*G*H +
-           A*G*G*H - 2*C*D*E*I + 2*B*D*F*I + 2*B*C*G*I - 2*A*F*G*I -
-           B*B*I*I + A*E*I*I + C*C*E*J - 2*B*C*F*J + A*F*F*J + B*B*H*J
-           - A*E*H*J) / denom;
-#endif
+/* put the points sharing an edge with p in nb, each once, and return how
+   many there are.  nb needs room for twice p's corners.  The first
+   *before come before p in one of its triangles, and can be merged into
+   p; the rest are only after p, along a boundary, and p has to be merged
+   into them instead.  Merging the other way over a boundary edge could
+   take a point the polygonizer still adds triangles to */
+static int ringneighbors(int p, int *nb, int *before)
+{
+   int c, n = 0, i;
+   for(c = PointCorner[p]; c; c = CornerNext[c]) {
+      /* their quadrics are wanted next, for the costs */
+      int np = Corners[prevcorner(c)];
+      prefetch(PointQ[np].Q);
+      prefetch(PointQ[np].Q + 9);
+      nb[n++] = np;
+   }
+
+   /* the point after p in a triangle is usually before p in another,
+      except along a boundary */
+   *before = n;
+   for(c = PointCorner[p]; c; c = CornerNext[c]) {
+      int np = Corners[nextcorner(c)];
+      for(i = 0; i < *before; i++)
+         if(nb[i] == np)
+            break;
+      if(i == *before)
+         nb[n++] = np;
+   }
+   return n;
 }
 
-/* if init is set, then only half the connections are scanned
-   (so we don't test a to b as well as b to a) */
-void CalculateQuadricPoint(struct point_t *p, int init)
-{
-   mfloat minc = 1.0/0.0;
-   struct point_t *minp = NULL;
-   struct trilist_t *l;
-
-   for(l = p->tris; l; l=l->next) {
-      struct tri_t *tri = l->tri;
-      int ni;
-      struct point_t *np;
-      
-      if(tri->p[0] == p)
-         ni = 0;
-      else if(tri->p[1] == p)
-         ni = 1;
-      else
-         ni = 2;
-
-      np = tri->p[(ni+1)%3];
-
-      /* optimization to cut initial calculations in half (get updated
-         below anyway) */
-      if(init) {
-         if(p->index < np->index)
-            continue; 
-      } else
-      /* in the process of building, and the other point isn't in the heap */
-         if(np->index >= heapSize)
-            continue;
+/* Each point in the heap stands for the cheapest merge over its edges to
+   the other points in the heap, with the cost in PointCost and the other
+   point in PointLink, negated if the point is the one merged away.  A
+   merge changes the quadric of the point it keeps, so anything linked to
+   either point is unlinked, and an entry only stands while it is linked.
+   Unlinked entries are worked out again when they come to the top instead
+   of when the points around them change.  An entry's cost is never more
+   than the edges it stands for, and every edge is stood for by one of its
+   points, so the top entry, once it stands, is the cheapest merge there
+   is. */
+
+/* link p to the cheapest of the merges with the n points in nb, which are
+   all in the heap, costs holds the cost of each.  The first before can be
+   merged into p, the rest have p merged into them with penalty added */
+static void quadriclink(int p, const int *nb, const mfloat *costs, int n,
+                        int before, mfloat penalty)
+{
+   mfloat min = 1.0/0.0;
+   int i, link = 0;
+   for(i = 0; i < n; i++) {
+      mfloat cost = i < before ? costs[i] : costs[i] + penalty;
+      if(!link || cost < min) {
+         min = cost;
+         link = i < before ? nb[i] : -nb[i];
+      }
+   }
 
-      mfloat c = CalculateQuadricContractionCost(p->Q, np->Q);
+   PointCost[p] = min;
+   PointLink[p] = link;
+}
 
-#if 1 /* optional step, appears to improve quality (small slowdown) */
-      if(np->cost > c) {
-         np->cost = c;
-         np->mp = p;
-         heapUpdate(np);
-      }
+/* unlink p if it is linked to p1 or p2, which are being merged */
+static inline void quadricunlink(int p, int p1, int p2)
+{
+   int q = abs(PointLink[p]);
+   if(q == p1 || q == p2)
+      PointLink[p] = 0;
+}
+
+/* whether p's entry still stands */
+static inline int quadricvalid(int p)
+{
+#ifdef DEBUG
+   int q = abs(PointLink[p]);
+   if(q && (PointIndex[q] < 0 || PointIndex[q] >= heapSize))
+      die("point linked outside the heap\n");
 #endif
-      /* update the other's cost */
-      else if(np->mp == p) {
-         np->cost = c;
-         heapUpdate(np); /* optional, improves quality (large slowdown) */
-      }
+   return PointLink[p] != 0;
+}
 
-      /* must have <=, minc starts at inf, the min cost might be inf */
-      if(c <= minc) {  
-         minc = c;
-         minp = np;
-      }
+/* the merge p's entry stands for */
+static inline void quadricmerge(int p, int *p1, int *p2)
+{
+   int q = PointLink[p];
+   if(q > 0)
+      *p1 = p, *p2 = q;
+   else
+      *p1 = -q, *p2 = p;
+}
+
+static int *SortNeighbors, SortNeighborSlots;
+static mfloat *SortCosts;
+
+/* work out p's entry from the edges to the points in the heap, penalty is
+   added to the cost of merging p away.  p is put in the heap or moved in
+   it afterward */
+void QuadricPoint(int p, mfloat penalty)
+{
+   int c, corners = 0, i;
+   for(c = PointCorner[p]; c; c = CornerNext[c])
+      corners++;
+   if(2 * corners > SortNeighborSlots) {
+      SortNeighborSlots = 4 * corners;
+      SortNeighbors = realloc(SortNeighbors,
+                              SortNeighborSlots * sizeof *SortNeighbors);
+      SortCosts = realloc(SortCosts, SortNeighborSlots * sizeof *SortCosts);
    }
 
-   p->cost = minc;
-   p->mp = minp;
-}
-
-/* attempt to calculate contraction cost based on
-   linear algebra that takes edges into account, not currently used */
-void CalculateEdgePoint(struct point_t *p, int init)
-{
-   mfloat minc = 1.0/0.0;
-   struct point_t *minp = NULL;
-   struct trilist_t *l;
-
-   mfloat inc=0;
-   for(l = p->tris; l; l=l->next) {
-      struct tri_t *tri = l->tri;
-      int ni;
-      struct point_t *np, *op;
-      
-      if(tri->p[0] == p)
-         ni = 0;
-      else if(tri->p[1] == p)
-         ni = 1;
-      else
-         ni = 2;
-
-      np = tri->p[(ni+1)%3];
-      op = tri->p[(ni+2)%3];
-
-      mfloat vec[3][3];
-      sub3(vec[0], p->pos, np->pos);
-      sub3(vec[1], p->pos, op->pos);
-
-      mfloat cr[3];
-      cross(cr, vec[0], vec[1]);
-
-      struct trilist_t *m;
-      for(m = p->tris; m; m=m->next) {
-         struct tri_t *tri2 = m->tri;
-
-         int i;
-         for(i = 0; i<3; i++) {
-            struct point_t *mp = tri2->p[i];
-            if(mp == p || mp == np || mp == op)
-               continue;
-            sub3(vec[2], p->pos, mp->pos);
-            mfloat fac = dot(cr, vec[2]) / dot(cr, cr);
-            cr[0] *= fac, cr[1] *= fac, cr[2] *= fac;
-            sub3(vec[2], vec[2], cr);
-
-            vec[2][0] = -vec[2][0], vec[2][1] = -vec[2][1], vec[2][2] = -vec[2][2];
-            double x = dot(vec[0], vec[1]);
-            double y = dot(vec[0], vec[2]);
-            double z = dot(vec[1], vec[2]);
-
-            inc++;
-            if(y < x && z < x) {
-               double c = dot(vec[2], vec[2]) ;
-               if(c <= minc) {  
-                  minc = c;
-                  minp = mp;
-               }
-            }
+   /* keep the neighbors in the heap, and work out their costs at once.
+      Only while building are there points that aren't sorted yet */
+   int before, n = ringneighbors(p, SortNeighbors, &before);
+   if(heapSize < PointCount) {
+      int count = 0, sortedbefore = 0;
+      for(i = 0; i < n; i++) {
+         int np = SortNeighbors[i];
+         if(PointIndex[np] >= 0 && PointIndex[np] < heapSize) {
+            SortNeighbors[count++] = np;
+            if(i < before)
+               sortedbefore = count;
          }
       }
+      n = count, before = sortedbefore;
    }
 
-   p->cost = minc;
-   p->mp = minp;
+   QuadricCosts(PointQ[p].Q, SortNeighbors, n, SortCosts);
+   quadriclink(p, SortNeighbors, SortCosts, n, before, penalty);
 }
 
-double meteorPropagate(int iterations)
+/* find the least cost merge that still stands, working out the stale
+   entries that come to the top again, 0 if there is none */
+static int quadrictop(int *p1, int *p2)
 {
-   struct point_t *p;
-   mfloat improvement = 0;
-   mfloat num = 0;
-   int i;
-   for(i = 0; i<PointCount; i++) {
-      struct point_t *p = Heap[i];
-      mfloat *pos = p->pos;
-      mfloat n[3];
+   while(heapSize >= 2) {
+      int p = Heap[0];
+      if(quadricvalid(p)) {
+         quadricmerge(p, p1, p2);
+
+         /* the next top is most likely the cheapest child, load it
+            while this merge is done */
+         int k, next = 1;
+         for(k = 2; k <= HEAP_ARITY && k < heapSize; k++)
+            if(HeapCost[k] < HeapCost[next])
+               next = k;
+         prefetch(PointLink + Heap[next]);
+         prefetch(PointCorner + Heap[next]);
+         return 1;
+      }
+
+      QuadricPoint(p, 0);
+      heapUpdate(p);
+      /* nothing left costs less than a point with no merges */
+      if(!PointLink[p] && Heap[0] == p)
+         return 0;
+   }
+   return 0;
+}
+
+/* points given to each thread at a time while propagating, they are
+   moved together so each call to FuncBatch evaluates all of them */
+#define PROPAGATE_CHUNK FUNC_BATCH
+
+static int PropagateIterations;
+static double PropagateTolerance;
+
+/* from the last call to meteorPropagate */
+static long long PropagateEvaluations;
+static int PropagatePoints, PropagateConverged;
+
+/* what each chunk of points adds up, summed in order afterward */
+struct propagatechunk {
+   mfloat improvement;
+   int moved, converged;
+   long long evaluations;
+};
+
+/* move each point along its normal until the function is within the
+   tolerance there.  The step grows while it gets closer, and shrinks
+   and turns back when it overshoots */
+static void propagateworker(int i, void *arg)
+{
+   struct propagatechunk *chunk = (struct propagatechunk *)arg + i;
+   int start = i * PROPAGATE_CHUNK, count = PointCount - start, j, k, a;
+   if(count > PROPAGATE_CHUNK)
+      count = PROPAGATE_CHUNK;
+   if(count <= 0)
+      return;
+
+   double x[FUNC_BATCH], y[FUNC_BATCH], z[FUNC_BATCH], v[FUNC_BATCH];
+   mfloat pos[FUNC_BATCH][3], n[FUNC_BATCH][3], newpos[FUNC_BATCH][3];
+   mfloat val[FUNC_BATCH], startval[FUNC_BATCH], step[FUNC_BATCH];
+   int active[FUNC_BATCH], moving[FUNC_BATCH], nmoving = 0;
+
+   for(j = 0; j < count; j++) {
+      loadpos(pos[j], Heap[start + j]);
+      x[j] = pos[j][0], y[j] = pos[j][1], z[j] = pos[j][2];
+   }
+   FuncBatch(v, x, y, z, count);
+   chunk->evaluations += count;
+
+   for(j = 0; j < count; j++) {
+      val[j] = startval[j] = step[j] = v[j];
+      if(fabs(val[j]) <= PropagateTolerance) {
+         chunk->converged++;
+         continue;
+      }
 
 #ifdef USE_DOUBLE_FORMAT
-      NormalFunc(n, pos);
+      NormalFunc(n[j], pos[j]);
 #else
-      double dn[3], dpos[3] = {pos[0], pos[1], pos[2]};
+      double dn[3], dpos[3] = {pos[j][0], pos[j][1], pos[j][2]};
       NormalFunc(dn, dpos);
-      n[0] = dn[0], n[1] = dn[1], n[2] = dn[2];
+      n[j][0] = dn[0], n[j][1] = dn[1], n[j][2] = dn[2];
 #endif
-      normalize(n);
-      mfloat val = Func(pos[0], pos[1], pos[2]);
-      mfloat startval = val;
-      int i;
-      mfloat step = val;
-      if(val == 0)
-         continue;
+      normalize(n[j]);
+      moving[nmoving] = active[nmoving] = j;
+      nmoving++;
+   }
 
-      for(i = 0; i < iterations; i++) {
-         mfloat newpos[3] = {pos[0] + step*n[0],
-                             pos[1] + step*n[1], pos[2] + step*n[2]};
-         
-         mfloat newval = Func(newpos[0], newpos[1], newpos[2]);
-         if(fabs(val) < fabs(newval)) {
-            if(val*newval < 0)
-               step *= .5;
+   /* points drop out as they reach the tolerance */
+   int nactive = nmoving;
+   for(k = 0; k < PropagateIterations && nactive; k++) {
+      for(a = 0; a < nactive; a++) {
+         j = active[a];
+         newpos[a][0] = pos[j][0] + step[j]*n[j][0];
+         newpos[a][1] = pos[j][1] + step[j]*n[j][1];
+         newpos[a][2] = pos[j][2] + step[j]*n[j][2];
+         x[a] = newpos[a][0], y[a] = newpos[a][1], z[a] = newpos[a][2];
+      }
+      FuncBatch(v, x, y, z, nactive);
+      chunk->evaluations += nactive;
+
+      int remaining = 0;
+      for(a = 0; a < nactive; a++) {
+         j = active[a];
+         mfloat newval = v[a];
+         if(fabs(val[j]) < fabs(newval)) {
+            if(val[j]*newval < 0)
+               step[j] *= .5;
             else 
-               step *= -.5;
+               step[j] *= -.5;
          } else {
-            if(val*newval < 0)
-               step *= -.3;
+            if(val[j]*newval < 0)
+               step[j] *= -.3;
             else
-               step *= 1.2;
-            val = newval;
-            memcpy(pos, newpos, sizeof newpos);
+               step[j] *= 1.2;
+            val[j] = newval;
+            memcpy(pos[j], newpos[a], sizeof *newpos);
          }
-         if(newval == 0)
-            break;
+         if(fabs(val[j]) > PropagateTolerance)
+            active[remaining++] = j;
       }
-      improvement += (fabs(startval)-fabs(val))/fabs(startval);
-      num++;
+      nactive = remaining;
+   }
+
+   for(a = 0; a < nmoving; a++) {
+      j = moving[a];
+      storepos(Heap[start + j], pos[j]);
+      chunk->improvement += (fabs(startval[j])-fabs(val[j]))/fabs(startval[j]);
+      chunk->moved++;
+      if(fabs(val[j]) <= PropagateTolerance)
+         chunk->converged++;
    }
-   return improvement/num;
 }
 
-static void removetrilistitem(struct point_t *p, struct tri_t *tri)
+/* move the points toward the surface, in parallel, and return the
+   average improvement of the points moved */
+double meteorPropagate(int iterations)
 {
-   struct trilist_t **l = &p->tris;
-   while(*l) {
-      if((*l)->tri == tri) {
-         FreeTriListItem(l);
-         return;
-      }
-      l=&(*l)->next;
+   PropagateEvaluations = PropagatePoints = PropagateConverged = 0;
+   if(!FuncBatch || !NormalFunc || !PointCount)
+      return 0;
+
+   if(TransformPending)
+      ApplyTransform();
+
+   int chunks = (PointCount + PROPAGATE_CHUNK - 1) / PROPAGATE_CHUNK, i;
+   struct propagatechunk *stats = calloc(chunks, sizeof *stats);
+   if(!stats)
+      die("failed to allocate memory for propagation\n");
+
+   PropagateIterations = iterations;
+   ParallelRun(chunks, propagateworker, stats);
+
+   mfloat improvement = 0;
+   int moved = 0;
+   for(i = 0; i < chunks; i++) {
+      improvement += stats[i].improvement;
+      moved += stats[i].moved;
+      PropagateConverged += stats[i].converged;
+      PropagateEvaluations += stats[i].evaluations;
    }
-   die("couldn't find a triangle to remove\n");
+   free(stats);
+
+   PropagatePoints = PointCount;
+   if(!moved)
+      return 0;
+
+   progressiveStale();
+   return improvement/moved;
+}
+
+void meteorPropagateTolerance(double tolerance)
+{
+   PropagateTolerance = tolerance;
+}
+
+/* the average number of function evaluations for each point, and the
+   fraction of points within the tolerance, from the last propagation */
+void meteorPropagateStats(double *evaluations, double *converged)
+{
+   *evaluations = PropagatePoints
+      ? (double)PropagateEvaluations / PropagatePoints : 0;
+   *converged = PropagatePoints
+      ? (double)PropagateConverged / PropagatePoints : 0;
+}
+
+/* take corner c out of its point's ring of corners */
+void removeCorner(int c)
+{
+   int next = CornerNext[c], prev = CornerPrev[c];
+   if(prev)
+      CornerNext[prev] = next;
+   else
+      PointCorner[Corners[c]] = next;
+   if(next)
+      CornerPrev[next] = prev;
 }
 
-/* adds a tri the the trilist of a point */
-void addToTriList(struct point_t *p, struct tri_t *q)
+/* adds corner c to the front of its point's ring */
+void addCorner(int c)
 {
-   struct trilist_t *List = AllocTriList();
-   List->next = p->tris;
-   List->tri = q;
-   p->tris = List;
+   int p = Corners[c], next = PointCorner[p];
+   CornerNext[c] = next;
+   CornerPrev[c] = 0;
+   if(next)
+      CornerPrev[next] = c;
+   PointCorner[p] = c;
+}
+
+/* corner n of the same point takes the place of corner c in its ring */
+void replaceCorner(int c, int n)
+{
+   int next = CornerNext[c], prev = CornerPrev[c];
+   CornerNext[n] = next;
+   CornerPrev[n] = prev;
+   if(prev)
+      CornerNext[prev] = n;
+   else
+      PointCorner[Corners[n]] = n;
+   if(next)
+      CornerPrev[next] = n;
+}
+
+static inline int tricontains(int t, int p)
+{
+   int *tp = Corners + 3*t;
+   return tp[0] == p || tp[1] == p || tp[2] == p;
 }
 
 static inline void callfunc(void (*func)(double [3], double [3]),
-                            int Offset, struct point_t *p1,
-                            struct point_t *p2, struct point_t *p3)
+                            mfloat *data, mfloat pos[3],
+                            mfloat *data2, mfloat *data3)
 {
    if(func) {
+      /* calculated once merging is done */
+      if(LazyData) {
+         DataStale = 1;
+         return;
+      }
 #ifdef USE_DOUBLE_FORMAT
-      func(p1->data + Offset, p1->pos);
+      func(data, pos);
 #else
-      double data[3], dpos[3] = {p1->pos[0], p1->pos[1], p1->pos[2]};
-      func(data, dpos);
-      p1->data[Offset+0] = data[0];
-      p1->data[Offset+1] = data[1];
-      p1->data[Offset+2] = data[2];
+      double ddata[3], dpos[3] = {pos[0], pos[1], pos[2]};
+      func(ddata, dpos);
+      data[0] = ddata[0];
+      data[1] = ddata[1];
+      data[2] = ddata[2];
 #endif
       } else
-         avg3(p1->data+Offset, p2->data+Offset, p3->data+Offset);
+         avg3(data, data2, data3);
 }
 
-static inline void updateextra(struct point_t *p1, struct point_t *p2, struct point_t *p3)
+static inline void updateextra(int p1, int p2, int p3)
 {
+   if(!DataParts)
+      return;
+
+   mfloat pos[3], data[MAX_DATA], data2[MAX_DATA], data3[MAX_DATA];
+   loadpos(pos, p1);
+   loaddata(data, p1);
+   loaddata(data2, p2);
+   loaddata(data3, p3);
+
+#define CALLFUNC(func, Offset) \
+   callfunc(func, data + Offset, pos, data2 + Offset, data3 + Offset)
    if(DataFormat & METEOR_NORMALS)
-      callfunc(NormalFunc, NormalOffset, p1, p2, p3);
+      CALLFUNC(NormalFunc, NormalOffset);
    if(DataFormat & METEOR_COLORS)
-      callfunc(ColorFunc, ColorOffset, p1, p2, p3);
+      CALLFUNC(ColorFunc, ColorOffset);
    if(DataFormat & METEOR_TEXCOORDS)
-      callfunc(TexCoordFunc, TexCoordOffset, p1, p2, p3);
+      CALLFUNC(TexCoordFunc, TexCoordOffset);
+#undef CALLFUNC
+
+   storedata(p1, data);
 }
 
-/* this is a generic algorithm that takes the least cost point out of the heap,
-   and merges it with the point calculated to be the least cost to merge.  It
-   also updates all of the data structures involved for susequent operations */
-static inline void MergeTopOfHeap(int kd)
+/* A merge of p2 into p1 is done in two parts.  collapseedge only changes
+   p1, p2 and the rings of the points around them, so merges with separate
+   neighborhoods can be collapsed at the same time.  What it would do to the
+   heap and the free lists is recorded in events, in the order it happened,
+   and carried out by finishcollapse. */
+struct collapse {
+   int p1, p2;
+   /* where its events start in MergeEvents and how many there are, an
+      event is a point left without triangles, or -tri for a removed one */
+   int events, nevents;
+   /* for quadric merging, where collapseedge puts the points around p1's
+      new ring in MergeNeighbors, and the cost of each edge to them in
+      MergeCosts */
+   int edges, nedges, before;
+};
+
+static int *MergeEvents, MergeEventSlots;
+static int *MergeNeighbors;
+static mfloat *MergeCosts;
+static int MergeEdgeSlots;
+
+/* make room for events and edges of a round of merges */
+static void growmerges(int events, int edges)
 {
- restart:
-   if(heapSize < 2)
-      return;
-
-   struct point_t *p2 = Heap[0], *p1 = p2->mp;
-
-   /* The nearest neighbor might not be connected in a triangle (aggregation)
-      making it difficult to efficiently detect which points saw the removed
-      point as a nearest neighbor, so it's possible the current point
-      has a deleted nearest neighbor, recalculate it */
-   if(kd) {
-      if(p1->index == -1) {
-         kdTreeUpdate(p2);
-         p1 = p2->mp;
-      }
-   } else {
-      /* for quadric heap, only merges to points that share triangles
-         is allowed, check to make sure this point still shares a triangle
-         it could have been removed in the mean time */
-      /* consider always calculating here, and not storing mp?? */
-      struct trilist_t *v;
-      for(v = p2->tris; v; v=v->next) {
-         int i;
-         for(i = 0; i<3; i++)
-            if(v->tri->p[i] == p1)
-               goto haveit;
-      }
-      /* the precalculated mp is missing, recalculate it and update
-         the heap then try again */
-      CalculateOptimalPoint(p2, 0);
-      heapUpdate(p2);
-      goto restart;
+   if(events > MergeEventSlots) {
+      MergeEventSlots = 2 * events;
+      MergeEvents = realloc(MergeEvents, MergeEventSlots * sizeof *MergeEvents);
    }
- haveit:
 
-#ifdef DEBUG
-   if(p1->index >= heapSize)
-      die("invalid merge attempt\n");
+   if(edges > MergeEdgeSlots) {
+      MergeEdgeSlots = 2 * edges;
+      MergeNeighbors = realloc(MergeNeighbors,
+                               MergeEdgeSlots * sizeof *MergeNeighbors);
+      MergeCosts = realloc(MergeCosts, MergeEdgeSlots * sizeof *MergeCosts);
+   }
+}
 
-   if(p1 == p2)
-      die("p1 == p2\n");
-#endif
+static void collapseedge(struct collapse *m, int kd)
+{
+   int p1 = m->p1, p2 = m->p2;
 
+   mfloat pos1[3], pos2[3];
+   loadpos(pos1, p1);
+   loadpos(pos2, p2);
    if(kd) {
       /* always average position for aggregation */
-      avg3(p1->pos, p1->pos, p2->pos);
+      avg3(pos1, pos1, pos2);
    } else {
       /* set add p2's q matrix to p1's q matrix */
-      add4x4tri(p1->Q, p2->Q);
+      add4x4tri(PointQ[p1].Q, PointQ[p2].Q);
       /* set p1's position to the calculated position, if it can't
          be calculated with quadrics, just average the two points */
-      if(solvespecial(p1->pos, p1->Q))
-         avg3(p1->pos, p1->pos, p2->pos);
+      if(solvespecial(pos1, PointQ[p1].Q))
+         avg3(pos1, pos1, pos2);
    }
+   storepos(p1, pos1);
 
    /* update extra data for the point if it exists */
    updateextra(p1, p1, p2);
 
-   /* pull p2 out of the heap */
-   heapRemove(p2);
-   if(kd)
-      kdTreeRemove(p2);
-
    /* go through all of p2's triangles, and remove any that touch p1,
       including removing this triangle from each of its points' lists.
       otherwise update the triangle connected to p2 to connect to p1 instead */
-   struct trilist_t **t = &p2->tris;
-   while(*t) {
-      struct tri_t *rmtri = (*t)->tri;
+   int c = PointCorner[p2], last = 0, *events = MergeEvents + m->events;
+   m->nevents = 0;
+   while(c) {
+      int next = CornerNext[c], rmtri = c / 3, *tp = Corners + 3*rmtri;
       int i;
-      if(rmtri->p[0] == p1 || rmtri->p[1] == p1 || rmtri->p[2] == p1) {
+      if(tp[0] == p1 || tp[1] == p1 || tp[2] == p1) {
          for(i = 0; i < 3; i++) {
-            struct point_t *p = rmtri->p[i];
+            int p = tp[i];
             if(p != p2) {
-               removetrilistitem(p, rmtri);
-
-               if(p != p1) {
-                  /* if we remove all the triangles from this point, and it isn't
-                     p1 or p2, then remove the point */
-                  if(!p->tris) {
-                     /* don't remove it if it isn't in the heap yet */
-                     if(p->index <= heapSize) {
-                        heapRemove(p);
-                        if(kd)
-                           kdTreeRemove(p);
-                        FreePoint(p);
-                     }
-                  }
-               }
+               removeCorner(3*rmtri + i);
+               /* p may not be next to p1 anymore */
+               if(!kd && p != p1)
+                  quadricunlink(p, p1, p2);
+
+               /* if we remove all the triangles from this point, and it isn't
+                  p1 or p2, then the point is removed */
+               if(p != p1 && !PointCorner[p])
+                  events[m->nevents++] = p;
             }
          }
-         /* remove the triangle from p2's list */
-         FreeTriListItem(t);
-
-         /* free the triangle */
-         FreeTri(rmtri);
+         /* remove the triangle from p2's ring */
+         removeCorner(c);
+         events[m->nevents++] = -rmtri;
       } else {
          /* update all triangles attached to p2 to be attached to p1 instead */
-         for(i = 0; i < 3; i++)
-            if(rmtri->p[i] == p2)
-               goto ok;
-
-         die("did not find p2 in triangle in it's trilist\n");
-      ok:
-         rmtri->p[i] = p1;
-         t = &(*t)->next;
+         Corners[c] = p1;
+         last = c;
       }
+      c = next;
+   }
+
+   /* put what is left of p2's ring in front of p1's */
+   if(last) {
+      CornerNext[last] = PointCorner[p1];
+      if(PointCorner[p1])
+         CornerPrev[PointCorner[p1]] = last;
+      PointCorner[p1] = PointCorner[p2];
+   }
+
+   if(!kd) {
+      int *nb = MergeNeighbors + m->edges;
+      m->nedges = ringneighbors(p1, nb, &m->before);
+      QuadricCosts(PointQ[p1].Q, nb, m->nedges, MergeCosts + m->edges);
+
+      /* p2's other neighbors are now p1's, these are all in the
+         neighborhood taken for the round, so no other thread has them */
+      int i;
+      for(i = 0; i < m->nedges; i++)
+         quadricunlink(nb[i], p1, p2);
    }
+}
 
-   /* join p1 and p2's trilists and give it to p1, delete p2
-      since it is now merged with p1 */
-   *t = p1->tris;
-   p1->tris = p2->tris;
+static void finishcollapse(struct collapse *m, int kd)
+{
+   int p1 = m->p1, p2 = m->p2, *events = MergeEvents + m->events, i;
+
+   if(Progressive)
+      progressiveMerge(p1, p2);
 
-   /* removed above, now we can free */
+   /* pull p2 out of the heap */
+   heapRemove(p2);
+   if(kd)
+      kdTreeRemove(p2);
+
+   for(i = 0; i < m->nevents; i++) {
+      int e = events[i];
+      if(e > 0) {
+         /* don't remove it if it isn't in the heap yet */
+         if(PointIndex[e] <= heapSize) {
+            heapRemove(e);
+            if(kd)
+               kdTreeRemove(e);
+            FreePoint(e);
+         }
+      } else {
+         /* free the triangle */
+         if(Progressive)
+            progressiveRemove(-e);
+         FreeTri(-e);
+      }
+   }
+
+   /* p2 is now merged with p1 */
    FreePoint(p2);
 
    /* if p1 has any triangles, update the cost for p1, otherwise delete p1 */
-   if(p1->tris) {
+   if(PointCorner[p1]) {
       if(kd)
          kdTreeUpdate(p1);
-      else
-         CalculateOptimalPoint(p1, 0);
+      else {
+         /* link p1 to the points in the heap around its new ring, the
+            others link to it once they are sorted */
+         int *nb = MergeNeighbors + m->edges, n = m->nedges;
+         int before = m->before;
+         mfloat *costs = MergeCosts + m->edges;
+         if(heapSize < PointCount)
+            for(i = n = before = 0; i < m->nedges; i++)
+               if(PointIndex[nb[i]] < heapSize) {
+                  nb[n] = nb[i];
+                  costs[n++] = costs[i];
+                  if(i < m->before)
+                     before = n;
+               }
+         quadriclink(p1, nb, costs, n, before, 0);
+      }
       heapUpdate(p1);
    } else {
       heapRemove(p1);
@@ -446,12 +618,74 @@ static inline void MergeTopOfHeap(int kd)
    }
 }
 
+/* merge p2 into p1, updating all of the data structures involved for
+   susequent operations */
+static void mergepoints(int p1, int p2, int kd)
+{
+#ifdef DEBUG
+   if(PointIndex[p1] >= heapSize)
+      die("invalid merge attempt\n");
+
+   if(p1 == p2)
+      die("p1 == p2\n");
+#endif
+
+   /* each of p2's triangles gives at most 3 events, and p1 ends up
+      next to at most 2 points for each corner.  The rings are counted side
+      by side so waiting on memory for one overlaps the other, and their
+      triangles are loaded for collapseedge */
+   int c1 = PointCorner[p1], c2 = PointCorner[p2], corners1 = 0, corners2 = 0;
+   while(c1 || c2) {
+      if(c1) {
+         prefetch(Corners + c1 - c1 % 3);
+         c1 = CornerNext[c1], corners1++;
+      }
+      if(c2) {
+         prefetch(Corners + c2 - c2 % 3);
+         c2 = CornerNext[c2], corners2++;
+      }
+   }
+   growmerges(3 * corners2, 2 * (corners1 + corners2));
+
+   struct collapse m = {p1, p2};
+   collapseedge(&m, kd);
+   finishcollapse(&m, kd);
+}
+
+/* this is a generic algorithm that takes the least cost merge out of the
+   heap, and performs it */
+static inline void MergeTopOfHeap(int kd)
+{
+   if(heapSize < 2)
+      return;
+
+   int p1, p2;
+   if(kd) {
+      p2 = Heap[0], p1 = PointLink[p2];
+
+      /* The nearest neighbor might not be connected in a triangle
+         (aggregation) making it difficult to efficiently detect which
+         points saw the removed point as a nearest neighbor, so it's possible
+         the current point has a deleted nearest neighbor, recalculate it */
+      if(PointIndex[p1] == -1) {
+         kdTreeUpdate(p2);
+         p1 = PointLink[p2];
+      }
+   } else if(!quadrictop(&p1, &p2))
+      return;
+
+   mergepoints(p1, p2, kd);
+}
+
 /* perform a pair contraction, and return the number of triangles removed */
 int meteorMerge(void)
 {
    /* make sure the points are sorted based on contraction cost */
    buildQHeap();
 
+   if(Progressive)
+      progressiveStart();
+
    /* keep track of initial triangle count */
    int num = TriangleCount;
 
@@ -463,299 +697,761 @@ int meteorMerge(void)
    return diff;
 }
 
+static int (*MergeProgress)(int triangles);
+static int MergeProgressInterval = 1;
+
+void meteorMergeProgress(int (*progress)(int triangles), int interval)
+{
+   MergeProgress = progress;
+   MergeProgressInterval = interval > 0 ? interval : 1;
+}
+
+static double gettime(void)
+{
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* merges done between looks at the clock */
+#define MERGE_CLOCK 256
+
+/* merge edges until no more than triangles mergeable triangles are left,
+   the next merge would cost more than error (unless it is negative), or
+   seconds have gone by (unless it is 0).  Return the number of triangles
+   removed */
+int meteorMergeTo(int triangles, double error, double seconds)
+{
+   double stop = seconds > 0 ? gettime() + seconds : 0;
+
+   buildQHeap();
+
+   if(Progressive)
+      progressiveStart();
+
+   int num = TriangleCount, merges = 0;
+   int report = TriangleCount - MergeProgressInterval;
+
+   while(SortedTriangleCount > triangles) {
+      int p1, p2;
+      if(!quadrictop(&p1, &p2) || (error >= 0 && HeapCost[0] > error))
+         break;
+
+      int count = TriangleCount;
+      mergepoints(p1, p2, 0);
+      SortedTriangleCount -= count - TriangleCount;
+
+      if(MergeProgress && TriangleCount <= report) {
+         report = TriangleCount - MergeProgressInterval;
+         if(MergeProgress(TriangleCount))
+            break;
+      }
+
+      if(stop && ++merges % MERGE_CLOCK == 0 && gettime() >= stop)
+         break;
+   }
+
+   MeshModified = 1;
+   return num - TriangleCount;
+}
+
+/* Merging in rounds: each round looks at the cheapest part of the heap in
+   order of cost and takes every merge whose neighborhood (the points of the
+   triangles around p1 and p2) doesn't overlap one already taken.  Those
+   merges don't touch each other's points, so they are collapsed together
+   across threads, then the heap is updated for each in turn. */
+
+/* points whose neighborhood is taken this round are marked with Round */
+static int *RoundMark, RoundMarkSlots, Round;
+
+static struct collapse *Batch;
+static int BatchSlots;
+
+/* positions in Heap being looked at with their costs, kept as a heap of
+   their own so they come out cheapest first */
+struct candidate {
+   mfloat cost;
+   int h;
+};
+
+static struct candidate *Candidates;
+static int CandidateSlots;
+
+/* points found stale during the round, worked out again at its end */
+static int *Deferred, DeferredSlots;
+
+/* merges handed to each thread at once */
+#define COLLAPSE_CHUNK 64
+
+static void collapseworker(int i, void *arg)
+{
+   int *count = arg, j, end = (i + 1) * COLLAPSE_CHUNK;
+   if(end > *count)
+      end = *count;
+   for(j = i * COLLAPSE_CHUNK; j < end; j++)
+      collapseedge(Batch + j, 0);
+}
+
+static void pushcandidate(int *count, int h)
+{
+   if(*count == CandidateSlots) {
+      CandidateSlots = CandidateSlots ? 2 * CandidateSlots : 1024;
+      Candidates = realloc(Candidates, CandidateSlots * sizeof *Candidates);
+   }
+
+   struct candidate new = {HeapCost[h], h};
+   int n = (*count)++;
+   while(n && new.cost < Candidates[(n - 1) / 2].cost) {
+      Candidates[n] = Candidates[(n - 1) / 2];
+      n = (n - 1) / 2;
+   }
+   Candidates[n] = new;
+}
+
+static int popcandidate(int *count)
+{
+   int h = Candidates[0].h, n = 0, c;
+   struct candidate last = Candidates[--*count];
+   while((c = 2*n + 1) < *count) {
+      if(c + 1 < *count && Candidates[c + 1].cost < Candidates[c].cost)
+         c++;
+      if(last.cost <= Candidates[c].cost)
+         break;
+      Candidates[n] = Candidates[c];
+      n = c;
+   }
+   Candidates[n] = last;
+   return h;
+}
+
+/* take the neighborhood of p1 and p2 if none of it is taken yet, return
+   the number of corners they have, or 0 if it couldn't be taken */
+static int takeneighborhood(int p1, int p2)
+{
+   /* most overlaps are with p1 or p2 themselves */
+   if(RoundMark[p1] == Round || RoundMark[p2] == Round)
+      return 0;
+
+   int p, c, i, corners = 0;
+   for(p = p1; p; p = p == p1 ? p2 : 0)
+      for(c = PointCorner[p]; c; c = CornerNext[c]) {
+         int *tp = Corners + 3*(c / 3);
+         for(i = 0; i < 3; i++)
+            if(RoundMark[tp[i]] == Round)
+               return 0;
+         corners++;
+      }
+
+   for(p = p1; p; p = p == p1 ? p2 : 0)
+      for(c = PointCorner[p]; c; c = CornerNext[c]) {
+         int *tp = Corners + 3*(c / 3);
+         for(i = 0; i < 3; i++)
+            RoundMark[tp[i]] = Round;
+      }
+   return corners;
+}
+
+static int mergeround(int triangles, double tolerance)
+{
+   int p1, p2;
+   /* the cheapest merge has to stand, so every round takes at least one */
+   if(!quadrictop(&p1, &p2))
+      return 0;
+
+   Round++;
+
+   int look = tolerance * heapSize, want = SortedTriangleCount - triangles;
+   if(look < 1)
+      look = 1;
+
+   int count = 0, candidates = 0, removing = 0, events = 0, edges = 0;
+   int deferred = 0, k, c;
+   pushcandidate(&candidates, 0);
+   for(k = 0; k < look && candidates && removing < want; k++) {
+      int h = popcandidate(&candidates), p = Heap[h];
+      for(c = HEAP_ARITY*h + 1; c <= HEAP_ARITY*h + HEAP_ARITY; c++)
+         if(c < heapSize)
+            pushcandidate(&candidates, c);
+
+      if(!quadricvalid(p)) {
+         if(deferred == DeferredSlots) {
+            DeferredSlots = DeferredSlots ? 2 * DeferredSlots : 1024;
+            Deferred = realloc(Deferred, DeferredSlots * sizeof *Deferred);
+         }
+         Deferred[deferred++] = p;
+         continue;
+      }
+
+      quadricmerge(p, &p1, &p2);
+      int corners = takeneighborhood(p1, p2);
+      if(!corners)
+         continue;
+
+      if(count == BatchSlots) {
+         BatchSlots = BatchSlots ? 2 * BatchSlots : 1024;
+         Batch = realloc(Batch, BatchSlots * sizeof *Batch);
+      }
+
+      /* the events and edges are given room once the round is picked */
+      struct collapse *m = Batch + count++;
+      m->p1 = p1;
+      m->p2 = p2;
+      m->events = events;
+      m->edges = edges;
+      for(c = PointCorner[p2]; c; c = CornerNext[c])
+         if(tricontains(c / 3, p1)) {
+            removing++;
+            events += 3;
+         }
+      edges += 2 * corners;
+   }
+
+   growmerges(events, edges);
+
+   ParallelRun((count + COLLAPSE_CHUNK - 1) / COLLAPSE_CHUNK,
+               collapseworker, &count);
+
+   for(k = 0; k < count; k++)
+      finishcollapse(Batch + k, 0);
+
+   /* the stale points, unless they went away */
+   for(k = 0; k < deferred; k++) {
+      int p = Deferred[k];
+      if(PointIndex[p] >= 0 && PointIndex[p] < heapSize
+         && !quadricvalid(p)) {
+         QuadricPoint(p, 0);
+         heapUpdate(p);
+      }
+   }
+
+   return count;
+}
+
+/* merge edges until no more than triangles are left, and return the number
+   of triangles removed.  tolerance is the part of the points each round
+   looks at merges for, the larger it is the more merges are done at once,
+   and the more they stray from the order meteorMerge would take them in.
+   0 gives the same mesh as calling meteorMerge */
+int meteorMergeParallel(int triangles, double tolerance)
+{
+   buildQHeap();
+
+   if(Progressive)
+      progressiveStart();
+
+   if(PointSlots > RoundMarkSlots) {
+      RoundMark = realloc(RoundMark, PointSlots * sizeof *RoundMark);
+      memset(RoundMark + RoundMarkSlots, 0,
+             (PointSlots - RoundMarkSlots) * sizeof *RoundMark);
+      RoundMarkSlots = PointSlots;
+   }
+
+   /* stop on the mergeable triangles, the same as meteorMergeTo */
+   int num = TriangleCount;
+   while(SortedTriangleCount > triangles) {
+      int count = TriangleCount;
+      if(!mergeround(triangles, tolerance))
+         break;
+      SortedTriangleCount -= count - TriangleCount;
+   }
+
+   MeshModified = 1;
+   return num - TriangleCount;
+}
+
 /* join the two points that are closest together */
 int meteorAggregate(void)
 {
    if(!PointCount)
       return 0;
 
+   if(TransformPending)
+      ApplyTransform();
+
    if(heapMode != HEAP_AGGREGATE) {
-      kdTreeClear();
-      int i;
-      for(i = 0; i < PointCount; i++)
-         kdTreeInsert(Heap[i]);
+      heapSize = PointCount;
+      kdTreeBuild();
       heapSize = 0;
+      int i;
       for(i = 0; i<PointCount; i++)
          heapInsert(Heap[i]);
       heapMode = HEAP_AGGREGATE;
    }
 
+   if(Progressive)
+      progressiveStart();
+
    /* keep track of initial point count */
    int num = PointCount;
 
    MergeTopOfHeap(1);
+   kdTreeBalance();
 
    MeshModified = 1;
    return num - PointCount;
 }
 
-/* cut the edge with points p1, and p2, and use p as the intermediate point */
-static void sliceedge(struct point_t *p1, struct point_t *p2, struct point_t *p)
+/* points and edges given to each thread at a time while clipping */
+#define CLIP_CHUNK 256
+
+static double (*ClipFunc)(double, double, double);
+
+/* an edge crossing zero, and the point made where it crosses */
+struct clipedge {
+   int p1, p2, p;
+   int evaluations;
+};
+
+static struct clipedge *ClipEdges;
+static int ClipEdgeCount;
+
+static void clipcutworker(int i, void *arg)
 {
-   /* split all triangles that cross this boundary */
-   struct trilist_t *l;
-   for(l = p1->tris; l; l = l->next) {
-      struct tri_t *stri = l->tri;
-      int p1i, p2i = -1, p3i;
-      int i;
-      for(i = 0; i < 3; i++)
-         if(stri->p[i] == p1)
-            p1i = i;
-         else
-            if(stri->p[i] == p2)
-               p2i = i;
-            else
-               p3i = i;
+   int j, end = (i + 1) * CLIP_CHUNK;
+   if(end > PointCount)
+      end = PointCount;
+   for(j = i * CLIP_CHUNK; j < end; j++) {
+      mfloat pos[3];
+      loadpos(pos, Heap[j]);
+      PointCut[Heap[j]] = ClipFunc(pos[0], pos[1], pos[2]);
+   }
+}
 
-      /* we only care about triangles that touch p1 and p2 */
-      if(p2i == -1)
-         continue;
-      
-      struct point_t *p3 = stri->p[p3i];
-      struct tri_t *ntri = AllocTri();
-      
-      ntri->p[0] = p1;
-      /* get the order of the new triangle right */
-      if((p1i - p2i + 3)%3 == 2)
-         ntri->p[1] = p, ntri->p[2] = p3;
-      else
-         ntri->p[2] = p, ntri->p[1] = p3;
-
-      /* shift this triangle to use the new point instead of p1 */
-      stri->p[p1i] = p;
-
-      /* update the current trilist to use the new triangle */
-      l->tri = ntri;
-      
-      /* add these triangles to the appropriate point's tri lists */
-      addToTriList(p, stri);
-      addToTriList(p, ntri);
-      addToTriList(p3, ntri);
-   }
-}
-
-/* cut the meteor like a knife by splitting all edges that cut
-   the given equation */
-static void slicemeteor(double (*func)(double, double, double))
-{
-   int i;
-   for(i = 0; i<PointCount; i++) {
-      struct point_t *p = Heap[i];
-      p->cut = func(p->pos[0], p->pos[1], p->pos[2]);
-   }
-
-   /* for each triangle, split it into 3 pieces if needed */
-   struct tri_t *tri;
-   for(tri = Tris->next; tri != Tris; tri = tri->next) {
-      int i, j;
-      struct point_t *p1, *p2;
-      for(i = 2, j = 0; j < 3; i = j, j++) {
-         p1 = tri->p[i], p2 = tri->p[j];
-         if(p1->cut * p2->cut < 0) {
-            struct point_t *p = NewPoint();
-            
-            /* calculate new position, iterativly move it closer
-               to the cutting equation */
-            mfloat q1[4] = {p1->pos[0], p1->pos[1], p1->pos[2], p1->cut};
-            mfloat q2[4] = {p2->pos[0], p2->pos[1], p2->pos[2], p2->cut};
-            
-            iterativeimprove(p->pos, q1, q2, func);
-
-            /* the cut must be 0 even if it
-               isn't perfectly on the clipping func */
-            p->cut = 0;
-
-            /* update q matrix */
-            add4x4tri3(p->Q, p1->Q, p2->Q);
-            
-            /* update extra data for the point if it exists */
-            updateextra(p, p1, p2);
-
-            /* split the edge */
-            sliceedge(p1, p2, p);
-         }
-      }
+/* each edge only writes its own point */
+static void clipedgeworker(int i, void *arg)
+{
+   int j, end = (i + 1) * CLIP_CHUNK;
+   if(end > ClipEdgeCount)
+      end = ClipEdgeCount;
+   for(j = i * CLIP_CHUNK; j < end; j++) {
+      struct clipedge *e = ClipEdges + j;
+
+      /* iteratively move the point closer to the cutting equation */
+      mfloat pos[3], q1[4], q2[4];
+      loadpos(q1, e->p1);
+      q1[3] = PointCut[e->p1];
+      loadpos(q2, e->p2);
+      q2[3] = PointCut[e->p2];
+      e->evaluations = iterativeimprove(pos, q1, q2, ClipFunc, NULL);
+      storepos(e->p, pos);
+
+      /* lazy data only marks the data stale, which is done once after */
+      if(!LazyData)
+         updateextra(e->p, e->p1, e->p2);
    }
 }
 
+/* the same key for the edge either way around */
+static inline long long edgekey(int p1, int p2)
+{
+   return p1 < p2 ? (long long)p1 << 32 | p2 : (long long)p2 << 32 | p1;
+}
+
 /* remove parts of the meteor where the function provided is negative,
-   and create edges along 0, cutting then clipping is less optimal
-   than a specialized clipping routine, therefore this is not optimized
+   and create edges along 0.  The cut is worked out for every point, and a
+   point is made on each edge that crosses zero, in parallel.  Then each
+   triangle is clipped to the part where the cut isn't negative, keeping
+   its place or taking a second triangle for a quad.  The rings are made
+   again from what is left, and the negative points are freed as the heap
+   closes up, so everything is a pass over the points or triangles.
    This operation is O(n). */
 void meteorClip(double (*func)(double, double, double))
 {
-   slicemeteor(func);
+   if(TransformPending)
+      ApplyTransform();
 
-   int i, j;
-   /* go throught points, delete points that are negative cuts */
-   for(i = 0; i < PointCount; i++) {
-      struct point_t *p = Heap[i];
-      if(p->cut < 0) {
-         FreeTriList(p);
-         FreePoint(p);
-         
-         while(PointCount > i && Heap[PointCount]->cut < 0)
-            FreePoint(Heap[PointCount]);
+   int count = PointCount, i, j;
+   if(!count)
+      return;
+
+   ClipFunc = func;
+   RefineEdges = RefineEvaluations = 0;
+   ParallelRun((count + CLIP_CHUNK - 1) / CLIP_CHUNK, clipcutworker, NULL);
+
+   /* make a point for each edge that crosses */
+   struct hashtable edges = {0};
+   int slots = 0, tri;
+   ClipEdgeCount = 0;
+   for(tri = TriNext[0]; tri; tri = TriNext[tri])
+      for(i = 2, j = 0; j < 3; i = j, j++) {
+         int p1 = Corners[3*tri + i], p2 = Corners[3*tri + j], found;
+         if(!(PointCut[p1] * PointCut[p2] < 0))
+            continue;
+
+         union hashitem *item = hashInsert(&edges, edgekey(p1, p2), &found);
+         if(found)
+            continue;
+
+         int p = NewPoint();
+         PointCut[p] = 0;
+         item->point = p;
+
+         if(ClipEdgeCount == slots) {
+            slots = slots ? 2 * slots : 1024;
+            ClipEdges = realloc(ClipEdges, slots * sizeof *ClipEdges);
+         }
+         struct clipedge e = {p1, p2, p};
+         ClipEdges[ClipEdgeCount++] = e;
+      }
+
+   ParallelRun((ClipEdgeCount + CLIP_CHUNK - 1) / CLIP_CHUNK,
+               clipedgeworker, NULL);
+   for(i = 0; i < ClipEdgeCount; i++) {
+      if(LazyData)
+         updateextra(ClipEdges[i].p, ClipEdges[i].p1, ClipEdges[i].p2);
+      RefineEvaluations += ClipEdges[i].evaluations;
+   }
+   RefineEdges = ClipEdgeCount;
+
+   /* keep the part of each triangle that isn't negative, going around it
+      in order so it faces the same way */
+   int next;
+   for(tri = TriNext[0]; tri; tri = next) {
+      next = TriNext[tri];
+      int *tp = Corners + 3*tri, poly[4], n = 0;
+      for(i = 0; i < 3; i++) {
+         int p1 = tp[i], p2 = tp[i == 2 ? 0 : i + 1];
+         if(PointCut[p1] >= 0)
+            poly[n++] = p1;
+         if(PointCut[p1] * PointCut[p2] < 0)
+            poly[n++] = hashFind(&edges, edgekey(p1, p2))->point;
+      }
 
-         Heap[i] = Heap[PointCount];
-         Heap[i]->index = i;
+      if(n < 3)
+         FreeTri(tri);
+      else {
+         tp[0] = poly[0], tp[1] = poly[1], tp[2] = poly[2];
+         if(n == 4) {
+            int t = AllocTri();
+            Corners[3*t] = poly[0];
+            Corners[3*t + 1] = poly[2];
+            Corners[3*t + 2] = poly[3];
+         }
       }
    }
+   hashFree(&edges);
 
-   /* remove triangles that are on the negative side of the cut */
-   struct tri_t *ftri = Tris->next;
-   while(ftri != Tris) {
-      struct tri_t *tri = ftri;
-      ftri = ftri->next;
+   /* the rings are made again from the triangles left */
+   for(i = 0; i < PointCount; i++)
+      PointCorner[Heap[i]] = 0;
+   for(tri = TriNext[0]; tri; tri = TriNext[tri])
       for(j = 0; j < 3; j++)
-         if(tri->p[j]->cut < 0) {
-            FreeTri(tri);
-            tri->p[0] = NULL;
-            goto freed;
-         }
-   freed:;
-   }
-
-   /* this point is on the edge, we need to cut links * to removed tr */
-   for(i = 0; i < PointCount; i++) {
-      struct trilist_t **l = &Heap[i]->tris;
-      while(*l) {
-         struct tri_t *tri = (*l)->tri;
-         if(tri->p[0] == NULL)
-            FreeTriListItem(l);
-         else
-            l = &(*l)->next;
+         addCorner(3*tri + j);
+
+   /* free the points that are negative, and close up the heap */
+   for(i = j = 0; i < count + ClipEdgeCount; i++) {
+      int p = Heap[i];
+      if(PointCut[p] < 0)
+         FreePoint(p);
+      else {
+         Heap[j] = p;
+         PointIndex[p] = j++;
       }
    }
 
+   /* even with no new points the mesh may have lost whole parts */
+   progressiveStale();
+
+   /* merging has to sort the points and queue the edges again */
+   heapMode = HEAP_NONE;
    MeshModified = 1;
 }
 
 static const mfloat texcorrecttolerance = .4;
 
-static void correcttexcoordsaxis(int k)
+/* points, edges or triangles given to each thread at a time while
+   correcting texture coordinates */
+#define SEAM_CHUNK 256
+
+/* an edge that crosses the seam where texture coordinates wrap from 1 to
+   0 on the axes set in axes, and the point made on it */
+struct seamedge {
+   int p1, p2, p, axes;
+   mfloat mult; /* how far along the edge the point is */
+};
+
+/* a triangle with a point on some of its edges, edge i is from corner i
+   to the next one, and the triangles made for the extra pieces */
+struct seamtri {
+   int tri, points[3], pieces[3];
+};
+
+static struct seamedge *SeamEdges;
+static int SeamEdgeCount, SeamEdgeSlots;
+static struct seamtri *SeamTris;
+static int SeamTriCount, SeamTriSlots;
+
+/* p's texture coordinate on axis k, moved into (-.5, .5] so the seam is
+   where it changes sign */
+static inline mfloat seamtex(int p, int k)
 {
-   /* make sure all tex coords are between 0 and 1 */
-   int i;
-   for(i = 0; i < PointCount; i++) {
-      struct point_t *p = Heap[i];
-      mfloat *pt = p->data + TexCoordOffset;
-         
-      while(pt[k] >= 1)
-         pt[k]--;
-      while(pt[k] < 0)
-         pt[k]++;
+   mfloat t = getdata(p, TexCoordOffset + k);
+   return t > .5 ? t - 1 : t;
+}
 
-      if(isnan(pt[k]))
-         pt[k]=0;
+/* the axes the edge from p1 to p2 crosses the seam on.  Only one point is
+   made on an edge, where it crosses the lowest of them */
+static int seamaxes(int p1, int p2, mfloat *mult)
+{
+   int k, axes = 0;
+   for(k = 2; k >= 0; k--) {
+      mfloat tex1 = seamtex(p1, k), tex2 = seamtex(p2, k);
+      if(tex1 * tex2 < 0 && fabs(tex1 - tex2) < texcorrecttolerance) {
+         axes |= 1 << k;
+         *mult = fabs(tex1)/fabs(tex1 - tex2);
+      }
    }
+   return axes;
+}
 
-   /* for each triangle, see if any of the edges cross
-      a "texture boundary" in this case, make a new point
-      and split the edge, give it a texcoord of 0 */
-   struct tri_t *tri;
-   for(tri = Tris->next; tri != Tris; tri = tri->next) {
-      int j;
-      struct point_t *p1, *p2;
+/* make sure all tex coords are between 0 and 1 */
+static void seamwrapworker(int i, void *arg)
+{
+   int j, k, end = (i + 1) * SEAM_CHUNK;
+   if(end > PointCount)
+      end = PointCount;
+   for(j = i * SEAM_CHUNK; j < end; j++)
+      for(k = 0; k < 3; k++) {
+         mfloat t = getdata(Heap[j], TexCoordOffset + k);
+
+         while(t >= 1)
+            t--;
+         while(t < 0)
+            t++;
+
+         if(isnan(t))
+            t=0;
+         setdata(Heap[j], TexCoordOffset + k, t);
+      }
+}
 
-      for(i = 2, j = 0; j < 3; i = j, j++) {
-         p1 = tri->p[i], p2 = tri->p[j];
-         mfloat *p1t = p1->data + TexCoordOffset;
-         mfloat *p2t = p2->data + TexCoordOffset;
+/* interpolate the point on each edge, don't deal with poles */
+static void seamedgeworker(int i, void *arg)
+{
+   int j, k, end = (i + 1) * SEAM_CHUNK;
+   if(end > SeamEdgeCount)
+      end = SeamEdgeCount;
+   for(j = i * SEAM_CHUNK; j < end; j++) {
+      struct seamedge *e = SeamEdges + j;
+      mfloat pos[3], pos1[3], pos2[3], data[MAX_DATA], data2[MAX_DATA];
+      loadpos(pos1, e->p1);
+      loadpos(pos2, e->p2);
+      lininterpolate3(pos, pos1, pos2, e->mult);
+      storepos(e->p, pos);
+
+      /* the data is worked out now even with lazy data, working it out
+         later would undo the seam */
+      loaddata(data, e->p1);
+      loaddata(data2, e->p2);
+      for(k = 0; k < 3 * DataParts; k++)
+         data[k] = (data[k] + data2[k]) / 2;
+      storedata(e->p, data);
+      UpdatePointData(e->p);
+
+      for(k = 0; k < 3; k++)
+         if(e->axes & 1 << k)
+            setdata(e->p, TexCoordOffset + k, 0);
+   }
+}
 
-         mfloat tex1 = (p1t[k] > .5) ? (p1t[k] - 1) : p1t[k];
-         mfloat tex2 = (p2t[k] > .5) ? (p2t[k] - 1) : p2t[k];
+static inline void settri(int tri, int p1, int p2, int p3)
+{
+   Corners[3*tri] = p1, Corners[3*tri + 1] = p2, Corners[3*tri + 2] = p3;
+}
+
+/* split each triangle along the points on its edges, so no piece
+   crosses the seam.  Each triangle only writes itself and its pieces */
+static void seamtriworker(int i, void *arg)
+{
+   int j, k, end = (i + 1) * SEAM_CHUNK;
+   if(end > SeamTriCount)
+      end = SeamTriCount;
+   for(j = i * SEAM_CHUNK; j < end; j++) {
+      struct seamtri *t = SeamTris + j;
+      int *tp = Corners + 3*t->tri, *m = t->points;
+      int n = !!m[0] + !!m[1] + !!m[2];
+      if(n == 3) {
+         int a = tp[0], b = tp[1], c = tp[2];
+         settri(t->tri, a, m[0], m[2]);
+         settri(t->pieces[0], m[0], b, m[1]);
+         settri(t->pieces[1], m[2], m[1], c);
+         settri(t->pieces[2], m[0], m[1], m[2]);
+         continue;
+      }
+
+      /* turn it so edge 0 is the one split, or the one not split */
+      for(k = 0; k < 3; k++)
+         if(!m[k] == (n == 2))
+            break;
+      int x = tp[k], y = tp[(k + 1) % 3], z = tp[(k + 2) % 3];
+      if(n == 1) {
+         settri(t->tri, x, m[k], z);
+         settri(t->pieces[0], m[k], y, z);
+      } else {
+         int myz = m[(k + 1) % 3], mzx = m[(k + 2) % 3];
+         settri(t->tri, myz, z, mzx);
+         settri(t->pieces[0], x, y, myz);
+         settri(t->pieces[1], x, myz, mzx);
+      }
+   }
+}
 
-         if(tex1 * tex2 < 0 && fabs(tex1 - tex2) < texcorrecttolerance) {
-            struct point_t *p = NewPoint();
+/* the axes in zeros, where the point at corner c is at 0, that the
+   other corners of its triangle are past .5 on */
+static inline int seamside(int c, int zeros)
+{
+   int p2 = Corners[nextcorner(c)], p3 = Corners[prevcorner(c)], k, axes = 0;
+   for(k = 0; k < 3; k++)
+      if(zeros & 1 << k && (getdata(p2, TexCoordOffset + k) > .5
+                            || getdata(p3, TexCoordOffset + k) > .5))
+         axes |= 1 << k;
+   return axes;
+}
 
-            /* calculate new position, don't deal with poles,
-               just interpolate (with sane clamping) */
-            mfloat mult = fabs(tex1)/fabs(tex1 - tex2);
-            lininterpolate3(p->pos, p1->pos, p2->pos, mult);
+/* p's triangles whose other corners are past .5 on an axis where p is at
+   0 go to a copy of p at 1 on that axis.  A corner of the texture can
+   need a copy for each set of axes */
+static void seamduplicate(int p)
+{
+   int k, zeros = 0;
+   for(k = 0; k < 3; k++)
+      if(getdata(p, TexCoordOffset + k) == 0)
+         zeros |= 1 << k;
+   if(!zeros)
+      return;
 
-            /* update q matrix */
-            add4x4tri3(p->Q, p1->Q, p2->Q);
-            
-            /* update extra data for the point if it exists */
-            updateextra(p, p1, p2);
+   int c, next, copies[8] = {0}, stays = 0, moved = 0;
+   for(c = PointCorner[p]; c; c = CornerNext[c])
+      if(!seamside(c, zeros))
+         stays = 1;
 
-            /* mark 0 it for updating later */
-            mfloat *pt = p->data + TexCoordOffset;
-            pt[k] = 0;
+   for(c = PointCorner[p]; c; c = next) {
+      next = CornerNext[c];
+      int axes = seamside(c, zeros);
+      if(!axes)
+         continue;
 
-            /* split the edge */
-            sliceedge(p1, p2, p);
+      /* p itself is used for the first copy if none of its triangles
+         stay, it is set once they have all been looked at */
+      if(!copies[axes]) {
+         if(!stays && !moved) {
+            copies[axes] = p;
+            moved = axes;
+            continue;
          }
-      }
-   }
 
-   /* for each point with a texcoord of 0, make a point with a texcoord of 1 */
-   for(i = 0; i<PointCount; i++) {
-      struct point_t *p = Heap[i];
-      mfloat *pt = p->data + TexCoordOffset;
-      if(pt[k] == 0) {
-         struct point_t *np = NewPoint();
-         /* copy in the data */
-         memcpy(np->pos, p->pos, sizeof p->pos);
-
-         memcpy(np->Q, p->Q, sizeof p->Q);
-         memcpy(np->data, p->data, 3 * DataParts * sizeof *p->data);
-
-         /* set the new point's texcoord to 1 */
-         mfloat *npt = np->data + TexCoordOffset;
-         npt[k] = 1;
-
-         /* go through all the triangles, and put the right triangle
-            with the right point */
-         struct trilist_t **l = &p->tris;
-         while(*l) {
-            struct trilist_t *m = *l;
-            struct tri_t *tri = m->tri;
-
-            int p1i, p2i, p3i;
-            for(p1i = 0; p1i < 3; p1i++)
-               if(tri->p[p1i] == p)
-                  break;
-            p2i = (p1i + 1) % 3;
-            p3i = (p1i + 2) % 3;
-
-            mfloat *p2t = tri->p[p2i]->data + TexCoordOffset;
-            mfloat *p3t = tri->p[p3i]->data + TexCoordOffset;
-            if(p2t[k] > .5 || p3t[k] > .5) {
-               /* this triangle belongs with np not p */
-               tri->p[p1i] = np;
-               *l = m->next;
-               m->next = np->tris;
-               np->tris = m;
-            } else
-               l=&(*l)->next;
-         }
+         int np = NewPoint();
+         mfloat pos[3], data[MAX_DATA];
+         loadpos(pos, p);
+         storepos(np, pos);
+         loaddata(data, p);
+         for(k = 0; k < 3; k++)
+            if(axes & 1 << k)
+               data[TexCoordOffset + k] = 1;
+         storedata(np, data);
+         copies[axes] = np;
+      }
 
-         /* clean up points without triangles */
-         if(!p->tris) {
-            FreePoint(p);
-            Heap[i] = np;
-            np->index = i;
-         } else
-         if(!np->tris)
-            FreePoint(np);
+      if(copies[axes] != p) {
+         removeCorner(c);
+         Corners[c] = copies[axes];
+         addCorner(c);
       }
    }
+
+   for(k = 0; k < 3; k++)
+      if(moved & 1 << k)
+         setdata(p, TexCoordOffset + k, 1);
 }
 
 /* attempt to modify the meteor so it has duplicate located points with
-   different texture coordinates. does not handle so-called "poles".  */
+   different texture coordinates. does not handle so-called "poles".
+   Every edge crossing the seam on any axis is split once, by splitting
+   the triangles around it in parallel, then one sweep over the points
+   copies the ones on the seam */
 void meteorCorrectTexCoords(void)
 {
    if(!(DataFormat & METEOR_TEXCOORDS))
       return;
 
-   /* correct for each axis */
-   int i;
-   for(i = 0; i < 3; i++)
-      correcttexcoordsaxis(i);
+   if(TransformPending)
+      ApplyTransform();
+
+   if(DataStale)
+      UpdateData();
+
+   int count = PointCount, i, j;
+   ParallelRun((count + SEAM_CHUNK - 1) / SEAM_CHUNK, seamwrapworker, NULL);
+
+   /* make a point on each edge crossing the seam, and list the
+      triangles that have one */
+   struct hashtable edges = {0};
+   int tri;
+   SeamEdgeCount = SeamTriCount = 0;
+   for(tri = TriNext[0]; tri; tri = TriNext[tri]) {
+      struct seamtri t = {tri};
+      int split = 0;
+      for(i = 0; i < 3; i++) {
+         int p1 = Corners[3*tri + i], p2 = Corners[3*tri + (i + 1) % 3];
+         mfloat mult;
+         int axes = seamaxes(p1, p2, &mult), found;
+         if(!axes)
+            continue;
+
+         union hashitem *item = hashInsert(&edges, edgekey(p1, p2), &found);
+         if(!found) {
+            if(SeamEdgeCount == SeamEdgeSlots) {
+               SeamEdgeSlots = SeamEdgeSlots ? 2 * SeamEdgeSlots : 1024;
+               SeamEdges = realloc(SeamEdges,
+                                   SeamEdgeSlots * sizeof *SeamEdges);
+            }
+            struct seamedge e = {p1, p2, NewPoint(), axes, mult};
+            SeamEdges[SeamEdgeCount++] = e;
+            item->point = e.p;
+         }
+         t.points[i] = item->point;
+         split++;
+      }
+
+      if(split) {
+         if(SeamTriCount == SeamTriSlots) {
+            SeamTriSlots = SeamTriSlots ? 2 * SeamTriSlots : 1024;
+            SeamTris = realloc(SeamTris, SeamTriSlots * sizeof *SeamTris);
+         }
+         SeamTris[SeamTriCount++] = t;
+      }
+   }
+   hashFree(&edges);
+
+   /* a triangle with n points on its edges is cut into n + 1 pieces */
+   for(i = 0; i < SeamTriCount; i++) {
+      struct seamtri *t = SeamTris + i;
+      int n = !!t->points[0] + !!t->points[1] + !!t->points[2];
+      for(j = 0; j < n; j++)
+         t->pieces[j] = AllocTri();
+   }
+
+   ParallelRun((SeamEdgeCount + SEAM_CHUNK - 1) / SEAM_CHUNK,
+               seamedgeworker, NULL);
+   ParallelRun((SeamTriCount + SEAM_CHUNK - 1) / SEAM_CHUNK,
+               seamtriworker, NULL);
 
+   /* the rings are made again from the pieces */
+   for(i = 0; i < PointCount; i++)
+      PointCorner[Heap[i]] = 0;
+   for(tri = TriNext[0]; tri; tri = TriNext[tri])
+      for(j = 0; j < 3; j++)
+         addCorner(3*tri + j);
+
+   /* the copies made are added after the points swept */
+   count = PointCount;
+   for(i = 0; i < count; i++)
+      seamduplicate(Heap[i]);
+
+   /* the texture coordinates were unwrapped even if no edge was split */
+   progressiveStale();
+
+   heapMode = HEAP_NONE;
    MeshModified = 1;
 }
 
@@ -767,15 +1463,21 @@ static void updateOffsets(void)
    DataParts = TexCoordOffset/3 + !!(DataFormat & METEOR_TEXCOORDS);
 }
 
+/* storage type asked for by meteorStorage */
+static int StorageType = METEOR_DOUBLE;
+
+void meteorStorage(int type)
+{
+   StorageType = type;
+}
+
 void meteorReset(int format)
 {
-#if 1
-   CalculateOptimalPoint = CalculateQuadricPoint;
-#else
-   CalculateOptimalPoint = CalculateEdgePoint;
-#endif
+   QuadricKernel(QUADRIC_AVX2);
 
    freeMem();
+   progressiveFree();
+   FloatStorage = StorageType == METEOR_FLOAT;
    DataFormat = format | METEOR_COORDS;
    updateOffsets();
    meteorRewind();
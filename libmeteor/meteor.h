@@ -39,22 +39,35 @@ void meteorSetSize(double xmin, double xmax, double ymin, double ymax,
 
 void meteorReset(int format);
 
+/* type positions and data are stored as from the next meteorReset,
+   METEOR_FLOAT halves their memory, computation stays at full precision */
+void meteorStorage(int type);
+
 int meteorFormat(void);
 
 int meteorBuild(void);
+void meteorThreads(int count);
+void meteorSeeds(double *points, int count);
 
 int meteorMerge(void);
+int meteorMergeTo(int triangles, double error, double seconds);
+void meteorMergeProgress(int (*progress)(int triangles), int interval);
+int meteorMergeParallel(int triangles, double tolerance);
 int meteorAggregate(void);
+int meteorCluster(int points, double size);
 void meteorClip(double (*func)(double, double, double));
 void meteorCorrectTexCoords(void);
 
 double meteorPropagate(int);
+void meteorPropagateTolerance(double tolerance);
+void meteorPropagateStats(double *evaluations, double *converged);
 
 const char *meteorError(void);
 
 /* high level meteor file io routines */
 enum {METEOR_FILE_FORMAT_TEXT, METEOR_FILE_FORMAT_BINARY,
-      METEOR_FILE_FORMAT_VIDEOSCAPE, METEOR_FILE_FORMAT_WAVEFRONT};
+      METEOR_FILE_FORMAT_VIDEOSCAPE, METEOR_FILE_FORMAT_WAVEFRONT,
+      METEOR_FILE_FORMAT_PROGRESSIVE};
 
 #ifdef _STDIO_H
 int meteorLoad(FILE *file, int dataformat);
@@ -77,6 +90,17 @@ int meteorReadTriangles(int count, int format, int type, void *data);
 int meteorWritePoints(int count, int format, int type, const void *data);
 int meteorWriteTriangles(int count, int format, int type, const void *data);
 
+/* progressive meshes, merges are recorded as vertex splits so the mesh
+   can be made again at any level between the full and merged mesh */
+void meteorProgressive(int record);
+int meteorProgressiveSize(int *basepoints, int *basetriangles);
+int meteorProgressiveLevel(int triangles);
+
+int meteorReadProgressivePoints(int start, int count, double *data);
+int meteorReadProgressiveTriangles(int start, int count, int *data);
+int meteorWriteProgressivePoints(int count, const double *data);
+int meteorWriteProgressiveTriangles(int count, const int *data);
+
 /* transformations */
 void meteorMultMatrix(double m[16]);
 void meteorRotate(double angle, double x, double y, double z);
@@ -85,9 +109,29 @@ void meteorScale(double x, double y, double z);
 
 /* meteor data generation callbacks */
 void meteorFunc(double (*func)(double x, double y, double z));
+void meteorFuncBatch(void (*func)(double *vals, const double *x,
+                                  const double *y, const double *z, int count));
+void meteorIntervalFunc(void (*func)(double range[2],
+                                     double min[3], double max[3]));
+void meteorLipschitz(double bound);
 void meteorNormalFunc(void (*func)(double[3], double[3]));
 void meteorColorFunc(void (*func)(double[3], double[3]));
 void meteorTexCoordFunc(void (*func)(double[3], double[3]));
+void meteorLazyData(int lazy);
+void meteorGradientFunc(void (*func)(double grad[3], double pos[3]));
+
+/* root refinement along edges crossing the surface */
+enum {METEOR_REFINE_REGULA_FALSI, METEOR_REFINE_ILLINOIS};
+void meteorRefine(int method, int iterations, double tolerance);
+double meteorRefineIterations(void);
+
+/* how the sampled function is turned into triangles */
+enum {METEOR_TETRAHEDRA, METEOR_MARCHING_CUBES, METEOR_SURFACE_NETS};
+void meteorPolygonizer(int method);
+
+/* hand the mesh to sink while building instead of keeping it */
+void meteorStream(void (*sink)(const double *points, int pointcount,
+                               const int *triangles, int trianglecount));
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,488 @@
+/*
+ * Copyright (C) 2007  Sean D'Epagnier   All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Progressive meshes.  While recording, the mesh as it is at the first
+   merge is kept along with each merge made after it, which point was kept,
+   which was removed, and the kept point's new position and data.  Each
+   triangle of the kept mesh knows the merge that removed it.
+
+   The mesh after any number of merges is then made in one pass: a point
+   stands for whatever it was merged into by then, and a triangle is there
+   if it wasn't removed yet.
+
+   Read out, the same thing is turned around into vertex splits, coarsest
+   first: the points of the fully merged (base) mesh, then for each split
+   the point it splits from, the new point and the parent's values after the
+   split.  Triangles always name the finest points, a reader at some level
+   uses the nearest ancestor of each which it has, so a file can be cut off
+   after any split and still be a mesh. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "internal.h"
+#include "meteor.h"
+
+extern int newmeteorerror;
+extern char meteorerror[256];
+
+#define ERROR(x) do { strcpy(meteorerror, __func__); strcat(meteorerror, ": "); \
+                   strcat(meteorerror, x); newmeteorerror = 1; return -1; } while(0)
+
+int Progressive; /* recording merges, see meteorProgressive */
+
+/* the mesh at the first merge, each point's position and data
+   (RecSize values) and each triangle's points */
+static int RecPoints, RecTris, RecSize;
+static mfloat *RecValues;
+static int *RecCorners;
+static int *RecRemoved; /* merge removing each triangle, -1 if never */
+
+/* each merge, the kept and removed point and the kept point's values */
+static int Merges, MergeSlots;
+static int (*MergePoints)[2];
+static mfloat *MergeValues;
+
+/* recorded point and triangle numbers of the mesh's points and triangles */
+static int *RecPointId, *RecTriId;
+
+/* anything but merging changed the mesh since it was recorded */
+static int RecStale;
+static unsigned int RecCreatedPoints, RecCreatedTriangles;
+
+/* the vertex splits read out, or written in to be turned into a recording */
+static int PMPoints, PMBase, PMTris;
+static int *PMParent, *PMSplitTris;
+static mfloat *PMValues; /* the point's values, then its parent's after */
+static int *PMCorners;
+static int PMWritten, PMSlots, PMTriSlots;
+
+#define GROW(a, n) a = realloc(a, (n) * sizeof *a)
+
+static void freesplits(void)
+{
+   free(PMParent);
+   free(PMSplitTris);
+   free(PMValues);
+   free(PMCorners);
+   PMParent = PMSplitTris = PMCorners = NULL;
+   PMValues = NULL;
+   PMPoints = PMBase = PMTris = PMWritten = PMSlots = PMTriSlots = 0;
+}
+
+void progressiveFree(void)
+{
+   free(RecValues);
+   free(RecCorners);
+   free(RecRemoved);
+   free(MergePoints);
+   free(MergeValues);
+   free(RecPointId);
+   free(RecTriId);
+   RecValues = MergeValues = NULL;
+   RecCorners = RecRemoved = RecPointId = RecTriId = NULL;
+   MergePoints = NULL;
+   RecPoints = RecTris = Merges = MergeSlots = 0;
+   RecStale = 0;
+
+   freesplits();
+}
+
+void progressiveStale(void)
+{
+   RecStale = 1;
+}
+
+static void loadvalues(mfloat *v, int p)
+{
+   loadpos(v, p);
+   loaddata(v + 3, p);
+}
+
+/* keep the mesh as it is now, unless it is the one already recorded */
+void progressiveStart(void)
+{
+   if(TransformPending)
+      ApplyTransform();
+
+   if(RecPoints && !RecStale && !PMWritten
+      && CreatedPoints == RecCreatedPoints
+      && CreatedTriangles == RecCreatedTriangles)
+      return;
+
+   progressiveFree();
+
+   /* the data put off by meteorLazyData is needed for every merge */
+   if(DataStale)
+      UpdateData();
+
+   RecSize = 3 + 3 * DataParts;
+   RecPoints = PointCount;
+   RecCreatedPoints = CreatedPoints;
+   RecCreatedTriangles = CreatedTriangles;
+
+   int i, maxp = 0, maxt = 0, tri;
+   for(i = 0; i < RecPoints; i++)
+      if(Heap[i] > maxp)
+         maxp = Heap[i];
+   for(tri = TriNext[0]; tri; tri = TriNext[tri]) {
+      if(tri > maxt)
+         maxt = tri;
+      RecTris++;
+   }
+
+   RecValues = malloc(RecPoints * RecSize * sizeof *RecValues);
+   RecPointId = malloc((maxp + 1) * sizeof *RecPointId);
+   for(i = 0; i < RecPoints; i++) {
+      RecPointId[Heap[i]] = i;
+      loadvalues(RecValues + i * RecSize, Heap[i]);
+   }
+
+   RecCorners = malloc(3 * RecTris * sizeof *RecCorners);
+   RecRemoved = malloc(RecTris * sizeof *RecRemoved);
+   RecTriId = malloc((maxt + 1) * sizeof *RecTriId);
+   for(i = 0, tri = TriNext[0]; tri; tri = TriNext[tri], i++) {
+      int k;
+      for(k = 0; k < 3; k++)
+         RecCorners[3*i + k] = RecPointId[Corners[3*tri + k]];
+      RecRemoved[i] = -1;
+      RecTriId[tri] = i;
+   }
+}
+
+/* p2 is merged into p1, which already has its new position and data */
+void progressiveMerge(int p1, int p2)
+{
+   if(Merges == MergeSlots) {
+      MergeSlots = MergeSlots ? 2 * MergeSlots : 1024;
+      GROW(MergePoints, MergeSlots);
+      GROW(MergeValues, MergeSlots * RecSize);
+   }
+
+   if(LazyData)
+      UpdatePointData(p1);
+
+   MergePoints[Merges][0] = RecPointId[p1];
+   MergePoints[Merges][1] = RecPointId[p2];
+   loadvalues(MergeValues + Merges * RecSize, p1);
+   Merges++;
+
+   freesplits();
+}
+
+/* tri is removed by the last merge */
+void progressiveRemove(int tri)
+{
+   RecRemoved[RecTriId[tri]] = Merges - 1;
+}
+
+/* turn the recording into vertex splits: the points never removed
+   come first, then the point removed by each merge, last merge first */
+static void makesplits(void)
+{
+   if(PMPoints || !RecPoints)
+      return;
+
+   int base = RecPoints - Merges, i, j, k;
+   int size = 2 * RecSize;
+
+   int *id = malloc(RecPoints * sizeof *id);
+   for(i = 0; i < RecPoints; i++)
+      id[i] = -1;
+   for(j = 0; j < Merges; j++)
+      id[MergePoints[j][1]] = base + Merges - 1 - j;
+   for(i = 0, k = 0; i < RecPoints; i++)
+      if(id[i] == -1)
+         id[i] = k++;
+
+   PMPoints = RecPoints;
+   PMBase = base;
+   PMParent = malloc(PMPoints * sizeof *PMParent);
+   PMSplitTris = calloc(PMPoints, sizeof *PMSplitTris);
+   PMValues = malloc(PMPoints * size * sizeof *PMValues);
+
+   /* go through the merges keeping the values each point has */
+   mfloat *cur = malloc(RecPoints * RecSize * sizeof *cur);
+   memcpy(cur, RecValues, RecPoints * RecSize * sizeof *cur);
+   for(j = 0; j < Merges; j++) {
+      int p1 = MergePoints[j][0], p2 = MergePoints[j][1];
+      mfloat *v = PMValues + id[p2] * size;
+      PMParent[id[p2]] = id[p1];
+      memcpy(v, cur + p2 * RecSize, RecSize * sizeof *v);
+      memcpy(v + RecSize, cur + p1 * RecSize, RecSize * sizeof *v);
+      memcpy(cur + p1 * RecSize, MergeValues + j * RecSize,
+             RecSize * sizeof *cur);
+   }
+   for(i = 0; i < RecPoints; i++)
+      if(id[i] < base) {
+         mfloat *v = PMValues + id[i] * size;
+         PMParent[id[i]] = -1;
+         memcpy(v, cur + i * RecSize, RecSize * sizeof *v);
+         memcpy(v + RecSize, v, RecSize * sizeof *v);
+      }
+   free(cur);
+
+   /* the triangles removed by a merge come back with its split,
+      order them by split with a counting sort */
+   int *start = calloc(Merges + 2, sizeof *start);
+   for(i = 0; i < RecTris; i++)
+      start[RecRemoved[i] < 0 ? 0 : Merges - RecRemoved[i]]++;
+   for(j = 1; j <= Merges; j++)
+      PMSplitTris[base + j - 1] = start[j];
+   for(j = Merges + 1; j > 0; j--)
+      start[j] = start[j - 1];
+   for(start[0] = 0, j = 1; j <= Merges + 1; j++)
+      start[j] += start[j - 1];
+
+   PMTris = RecTris;
+   PMCorners = malloc(3 * PMTris * sizeof *PMCorners);
+   for(i = 0; i < RecTris; i++) {
+      int t = start[RecRemoved[i] < 0 ? 0 : Merges - RecRemoved[i]]++;
+      for(k = 0; k < 3; k++)
+         PMCorners[3*t + k] = id[RecCorners[3*i + k]];
+   }
+
+   free(start);
+   free(id);
+}
+
+/* turn vertex splits written in back into a recording, the merges are
+   the splits backwards, the recorded mesh is the one with every split */
+static int makerecording(void)
+{
+   int base = PMBase, merges = PMPoints - base, size = 2 * RecSize;
+   int i, j, k;
+
+   for(i = base; i < PMPoints; i++)
+      if(PMParent[i] < 0 || PMParent[i] >= i)
+         ERROR("Invalid parent");
+
+   int basetris = PMTris;
+   for(i = base; i < PMPoints; i++)
+      basetris -= PMSplitTris[i];
+   if(basetris < 0)
+      ERROR("Too few triangles");
+
+   for(i = 0; i < 3 * PMTris; i++)
+      if(PMCorners[i] < 0 || PMCorners[i] >= PMPoints)
+         ERROR("Index out of range");
+
+   mfloat *cur = malloc(PMPoints * RecSize * sizeof *cur);
+   for(i = 0; i < base; i++)
+      memcpy(cur + i * RecSize, PMValues + i * size, RecSize * sizeof *cur);
+
+   MergeSlots = merges ? merges : 1;
+   MergePoints = malloc(MergeSlots * sizeof *MergePoints);
+   MergeValues = malloc(MergeSlots * RecSize * sizeof *MergeValues);
+   for(i = base; i < PMPoints; i++) {
+      j = merges - 1 - (i - base);
+      MergePoints[j][0] = PMParent[i];
+      MergePoints[j][1] = i;
+      memcpy(MergeValues + j * RecSize, cur + PMParent[i] * RecSize,
+             RecSize * sizeof *MergeValues);
+      memcpy(cur + i * RecSize, PMValues + i * size, RecSize * sizeof *cur);
+      memcpy(cur + PMParent[i] * RecSize, PMValues + i * size + RecSize,
+             RecSize * sizeof *cur);
+   }
+   Merges = merges;
+
+   RecPoints = PMPoints;
+   RecValues = cur;
+   RecTris = PMTris;
+   RecCorners = malloc(3 * RecTris * sizeof *RecCorners);
+   memcpy(RecCorners, PMCorners, 3 * RecTris * sizeof *RecCorners);
+   RecRemoved = malloc(RecTris * sizeof *RecRemoved);
+   for(i = 0; i < basetris; i++)
+      RecRemoved[i] = -1;
+   for(j = base; j < PMPoints; j++)
+      for(k = 0; k < PMSplitTris[j]; k++)
+         RecRemoved[i++] = merges - 1 - (j - base);
+
+   /* merging again records from the mesh it is done on */
+   RecStale = 1;
+   PMWritten = 0;
+   return 0;
+}
+
+void meteorProgressive(int record)
+{
+   Progressive = record;
+   if(!record)
+      progressiveFree();
+}
+
+int meteorProgressiveSize(int *basepoints, int *basetriangles)
+{
+   makesplits();
+
+   int i, tris = PMTris;
+   for(i = PMBase; i < PMPoints; i++)
+      tris -= PMSplitTris[i];
+
+   if(basepoints)
+      *basepoints = PMBase;
+   if(basetriangles)
+      *basetriangles = tris;
+   return PMPoints - PMBase;
+}
+
+/* make the mesh the recorded one after the fewest merges leaving
+   no more than the given number of triangles, or after all of them */
+int meteorProgressiveLevel(int triangles)
+{
+   if(PMWritten && makerecording() == -1)
+      return -1;
+
+   if(!RecPoints)
+      ERROR("Nothing recorded");
+   if(RecSize != 3 + 3 * DataParts)
+      ERROR("Format changed since recording");
+
+   int i, j, k;
+
+   /* triangles left after j merges */
+   int *removed = calloc(Merges + 1, sizeof *removed);
+   for(i = 0; i < RecTris; i++)
+      if(RecRemoved[i] >= 0)
+         removed[RecRemoved[i]]++;
+   int merges = 0, count = RecTris;
+   while(merges < Merges && count > triangles)
+      count -= removed[merges++];
+   free(removed);
+
+   /* what each point is merged into by then, and its values */
+   int *rep = malloc(RecPoints * sizeof *rep);
+   mfloat *cur = malloc(RecPoints * RecSize * sizeof *cur);
+   memcpy(cur, RecValues, RecPoints * RecSize * sizeof *cur);
+   for(i = 0; i < RecPoints; i++)
+      rep[i] = i;
+   for(j = 0; j < merges; j++)
+      memcpy(cur + MergePoints[j][0] * RecSize, MergeValues + j * RecSize,
+             RecSize * sizeof *cur);
+   for(j = merges - 1; j >= 0; j--)
+      rep[MergePoints[j][1]] = rep[MergePoints[j][0]];
+
+   freeMem();
+
+   /* only the points with triangles are made */
+   int *point = calloc(RecPoints, sizeof *point);
+   for(i = 0; i < RecTris; i++) {
+      if(RecRemoved[i] >= 0 && RecRemoved[i] < merges)
+         continue;
+
+      int p[3];
+      for(k = 0; k < 3; k++) {
+         int r = rep[RecCorners[3*i + k]];
+         if(!point[r]) {
+            point[r] = NewPoint();
+            storepos(point[r], cur + r * RecSize);
+            storedata(point[r], cur + r * RecSize + 3);
+         }
+         p[k] = point[r];
+      }
+      NewTriangle(p[0], p[1], p[2]);
+   }
+
+   free(point);
+   free(cur);
+   free(rep);
+
+   RecStale = 1;
+   MeshModified = 1;
+   return Merges - merges;
+}
+
+int meteorReadProgressivePoints(int start, int count, double *data)
+{
+   makesplits();
+
+   int size = 2 * RecSize, i, j;
+   for(i = 0; i < count && start + i < PMPoints; i++) {
+      int p = start + i;
+      *data++ = PMParent[p];
+      *data++ = PMSplitTris[p];
+      for(j = 0; j < size; j++)
+         *data++ = PMValues[p * size + j];
+   }
+   return i;
+}
+
+int meteorReadProgressiveTriangles(int start, int count, int *data)
+{
+   makesplits();
+
+   int i;
+   for(i = 0; i < count && start + i < PMTris; i++, data += 3)
+      memcpy(data, PMCorners + 3 * (start + i), sizeof *data * 3);
+   return i;
+}
+
+/* start over with splits written in */
+static void writesplits(void)
+{
+   if(PMWritten)
+      return;
+
+   progressiveFree();
+   RecSize = 3 + 3 * DataParts;
+   PMWritten = 1;
+}
+
+int meteorWriteProgressivePoints(int count, const double *data)
+{
+   writesplits();
+
+   int size = 2 * RecSize, i, j;
+   for(i = 0; i < count; i++) {
+      if(PMPoints == PMSlots) {
+         PMSlots = PMSlots ? 2 * PMSlots : 1024;
+         GROW(PMParent, PMSlots);
+         GROW(PMSplitTris, PMSlots);
+         GROW(PMValues, PMSlots * size);
+      }
+
+      int p = PMPoints;
+      PMParent[p] = *data++;
+      PMSplitTris[p] = *data++;
+      for(j = 0; j < size; j++)
+         PMValues[p * size + j] = *data++;
+
+      if(PMParent[p] < 0) {
+         if(PMBase != p)
+            ERROR("Base points must come first");
+         PMBase++;
+      } else if(PMSplitTris[p] < 0)
+         ERROR("Invalid triangle count");
+      PMPoints++;
+   }
+   return count;
+}
+
+int meteorWriteProgressiveTriangles(int count, const int *data)
+{
+   writesplits();
+
+   if(PMTris + count > PMTriSlots) {
+      while(PMTris + count > PMTriSlots)
+         PMTriSlots = PMTriSlots ? 2 * PMTriSlots : 1024;
+      GROW(PMCorners, 3 * PMTriSlots);
+   }
+   memcpy(PMCorners + 3 * PMTris, data, 3 * count * sizeof *data);
+   PMTris += count;
+   return count;
+}
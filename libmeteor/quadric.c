@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2007  Sean D'Epagnier   All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* The cost of contracting a point with each of its neighbors.  The
+   neighbors' quadrics are gathered a few at a time into vectors of
+   doubles so the closed form cost is worked out for all of them at once.
+   The same operations are done in the same order as the scalar version,
+   and no multiplies are fused, so every kernel gives the same costs.  The
+   kernel is picked at run time from what the processor supports, see
+   quadricbench.c for timing them. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "internal.h"
+
+void (*QuadricCosts)(const mfloat *q, const int *nb, int n, mfloat *costs);
+
+static inline mfloat quadriccost(const mfloat q1[10], const mfloat q2[10])
+{
+   mfloat A = q1[0]+q2[0], B = q1[1]+q2[1], C = q1[2]+q2[2];
+   mfloat D = q1[3]+q2[3], E = q1[4]+q2[4], F = q1[5]+q2[5];
+   mfloat G = q1[6]+q2[6], H = q1[7]+q2[7], I = q1[8]+q2[8];
+   mfloat J = q1[9]+q2[9];
+
+#if 1  /* use optimized version (see term-optimizer.scm) */
+   double t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+    t0 = (B * I);
+    t1 = (C * G);
+    t2 = (D * F);
+    t3 = (A * F);
+    t4 = (B * H);
+    t5 = (C * E);
+    t6 = (A * E);
+    t7 = (-2 * D);
+    t8 = (2 * t0);
+    t9 = (((F * t3) + (-2 * B * C * F) + (B * t4) + (C * t5)) - (t6 * H));
+
+   if(t9 == 0)
+      return 1.0/0.0;
+
+    return (J*t9 + I*I*t6 + t3*-2*G*I + t8*t1 + t8*t2 + t7*t5*I + G*H*A*G
+            + t7*t4*G + D*H*D*E + t2*t1*2 - t0*t0 - t1*t1 - t2*t2) / t9;
+#else
+    /* unoptimized */
+    /* this is value for x where x=Q^-1*v*Q where Q = q1+q2.
+       v is the third column of R^-1 where R is Q with the last row
+       of 0 0 0 1 */
+    /* Solve[{a*x+b*y+c*z+d==0, b*x+e*y+f*z+g==0, c*x+f*y+h*z+i==0,
+       cost==x*x*a+y*y*e+z*z*h+j+2*(x*y*b+x*z*c+x*d+y*z*f+y*g+z*i)}, {x,y,z,cost}] */
+
+   mfloat denom = (C*C*E - 2*B*C*F + A*F*F + B*B*H - A*E*H);
+   if(denom == 0)
+      return 1.0/0.0;
+
+   return (-D*D*F*F + 2*C*D*F*G - C*C*G*G + D*D*E*H - 2*B*D*G*H +
+           A*G*G*H - 2*C*D*E*I + 2*B*D*F*I + 2*B*C*G*I - 2*A*F*G*I -
+           B*B*I*I + A*E*I*I + C*C*E*J - 2*B*C*F*J + A*F*F*J + B*B*H*J
+           - A*E*H*J) / denom;
+#endif
+}
+
+static void costsscalar(const mfloat *q, const int *nb, int n, mfloat *costs)
+{
+   int i;
+   for(i = 0; i < n; i++)
+      costs[i] = quadriccost(q, PointQ[nb[i]].Q);
+}
+
+/* the vector kernels need gcc vector extensions on x86, and work in
+   doubles, with float or long double the scalar version mixes in other
+   precisions and is always used */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) \
+   && defined(USE_DOUBLE_FORMAT)
+#define QUADRIC_VECTOR
+
+typedef double v2d __attribute__((vector_size(16)));
+typedef double v4d __attribute__((vector_size(32)));
+
+/* sum of q[k] with element k of the quadrics in qn, one for each lane */
+#define SUMS2(k) {q[k] + qn[0][k], q[k] + qn[1][k]}
+#define SUMS4(k) {q[k] + qn[0][k], q[k] + qn[1][k], \
+                  q[k] + qn[2][k], q[k] + qn[3][k]}
+
+/* the body of a kernel working on LANES neighbors at once in vectors of
+   type VEC, the last group repeats its first neighbor to fill up */
+#define COSTS_BODY(VEC, LANES)                                              \
+   int i, j;                                                                \
+   for(i = 0; i < n; i += LANES) {                                          \
+      int m = n - i < LANES ? n - i : LANES;                                \
+      const mfloat *qn[LANES];                                              \
+      for(j = 0; j < LANES; j++)                                            \
+         qn[j] = PointQ[nb[i + (j < m ? j : 0)]].Q;                         \
+                                                                            \
+      VEC A = SUMS##LANES(0), B = SUMS##LANES(1), C = SUMS##LANES(2);       \
+      VEC D = SUMS##LANES(3), E = SUMS##LANES(4), F = SUMS##LANES(5);       \
+      VEC G = SUMS##LANES(6), H = SUMS##LANES(7), I = SUMS##LANES(8);       \
+      VEC J = SUMS##LANES(9);                                               \
+      VEC t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;                           \
+      t0 = (B * I);                                                         \
+      t1 = (C * G);                                                         \
+      t2 = (D * F);                                                         \
+      t3 = (A * F);                                                         \
+      t4 = (B * H);                                                         \
+      t5 = (C * E);                                                         \
+      t6 = (A * E);                                                         \
+      t7 = (-2 * D);                                                        \
+      t8 = (2 * t0);                                                        \
+      t9 = (((F * t3) + (-2 * B * C * F) + (B * t4) + (C * t5)) - (t6 * H)); \
+                                                                            \
+      VEC cost = (J*t9 + I*I*t6 + t3*-2*G*I + t8*t1 + t8*t2 + t7*t5*I       \
+                  + G*H*A*G + t7*t4*G + D*H*D*E + t2*t1*2 - t0*t0 - t1*t1   \
+                  - t2*t2) / t9;                                            \
+      for(j = 0; j < m; j++)                                                \
+         costs[i + j] = t9[j] == 0 ? 1.0/0.0 : cost[j];                     \
+   }
+
+__attribute__((target("sse2,no-fma")))
+static void costssse2(const mfloat *q, const int *nb, int n, mfloat *costs)
+{
+   COSTS_BODY(v2d, 2)
+}
+
+__attribute__((target("avx2,no-fma")))
+static void costsavx2(const mfloat *q, const int *nb, int n, mfloat *costs)
+{
+   COSTS_BODY(v4d, 4)
+}
+#endif
+
+/* use kernel if the processor has it, otherwise the best below it, and
+   return the kernel used */
+int QuadricKernel(int kernel)
+{
+#ifdef QUADRIC_VECTOR
+   __builtin_cpu_init();
+   if(kernel >= QUADRIC_AVX2 && __builtin_cpu_supports("avx2")) {
+      QuadricCosts = costsavx2;
+      return QUADRIC_AVX2;
+   }
+
+   if(kernel >= QUADRIC_SSE2 && __builtin_cpu_supports("sse2")) {
+      QuadricCosts = costssse2;
+      return QUADRIC_SSE2;
+   }
+#endif
+
+   QuadricCosts = costsscalar;
+   return QUADRIC_SCALAR;
+}
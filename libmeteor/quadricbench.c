@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2007  Sean D'Epagnier   All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* this program times the kernels in quadric.c against each other.  Each
+   point gets the quadric of 6 planes through it, like a point of a built
+   mesh, and 6 neighbors near it in memory.  The costs to the neighbors of
+   every point are worked out with each kernel the processor has, and
+   have to come out the same. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include "quadric.c"
+
+union pointq *PointQ;
+
+#define VALENCE 6
+
+static double gettime(void)
+{
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double randomunit(void)
+{
+   return 2.0 * rand() / RAND_MAX - 1;
+}
+
+/* add the quadric of a random plane through pos to q */
+static void addplane(mfloat q[10], const double pos[3])
+{
+   double n[4], len;
+   do {
+      n[0] = randomunit(), n[1] = randomunit(), n[2] = randomunit();
+      len = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+   } while(len == 0);
+   n[0] /= len, n[1] /= len, n[2] /= len;
+   n[3] = -(n[0]*pos[0] + n[1]*pos[1] + n[2]*pos[2]);
+
+   q[0] += n[0]*n[0], q[1] += n[0]*n[1], q[2] += n[0]*n[2], q[3] += n[0]*n[3];
+   q[4] += n[1]*n[1], q[5] += n[1]*n[2], q[6] += n[1]*n[3];
+   q[7] += n[2]*n[2], q[8] += n[2]*n[3];
+   q[9] += n[3]*n[3];
+}
+
+static const char *names[] = {"scalar", "sse2", "avx2"};
+
+int main(int argc, char **argv)
+{
+   int points = argc > 1 ? atoi(argv[1]) : 1000000;
+   if(points < 2 * VALENCE) {
+      fprintf(stderr, "usage: quadricbench [POINTS]\n");
+      return 1;
+   }
+
+   PointQ = calloc(points, sizeof *PointQ);
+   int *nb = malloc(VALENCE * points * sizeof *nb), p, i;
+   for(p = 0; p < points; p++) {
+      double pos[3] = {randomunit(), randomunit(), randomunit()};
+      for(i = 0; i < VALENCE; i++) {
+         addplane(PointQ[p].Q, pos);
+
+         /* neighbors are usually made close to each other */
+         int n = p + rand() % 2001 - 1000;
+         if(n < 0 || n >= points || n == p)
+            n = (p + i + 1) % points;
+         nb[VALENCE*p + i] = n;
+      }
+   }
+
+   mfloat *costs[3], *scalar = NULL;
+   double scalartime = 0;
+   int kernel;
+   for(kernel = QUADRIC_SCALAR; kernel <= QUADRIC_AVX2; kernel++) {
+      if(QuadricKernel(kernel) != kernel) {
+         printf("%-6s not supported\n", names[kernel]);
+         continue;
+      }
+
+      costs[kernel] = malloc(VALENCE * points * sizeof **costs);
+
+      /* take the best of a few runs */
+      double best = 1.0/0.0;
+      int run;
+      for(run = 0; run < 5; run++) {
+         double time = gettime();
+         for(p = 0; p < points; p++)
+            QuadricCosts(PointQ[p].Q, nb + VALENCE*p, VALENCE,
+                         costs[kernel] + VALENCE*p);
+         time = gettime() - time;
+         if(time < best)
+            best = time;
+      }
+
+      if(!scalar) {
+         scalar = costs[kernel];
+         scalartime = best;
+         printf("%-6s %f seconds for %d costs\n", names[kernel], best,
+                VALENCE * points);
+         continue;
+      }
+
+      for(i = 0; i < VALENCE * points; i++)
+         if(costs[kernel][i] != scalar[i]
+            && !(isnan(costs[kernel][i]) && isnan(scalar[i]))) {
+            fprintf(stderr, "%s gives %g instead of %g for cost %d\n",
+                    names[kernel], (double)costs[kernel][i],
+                    (double)scalar[i], i);
+            return 1;
+         }
+      printf("%-6s %f seconds (%.2fx)\n", names[kernel], best,
+             scalartime / best);
+   }
+   return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2007  Sean D'Epagnier   All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* This file contains a tiny work queue used to spread independent work
+   items across threads.  Items are handed out one at a time from a shared
+   counter, so a thread that finishes a cheap item simply takes the next
+   one instead of idling while another thread works through expensive items.
+   Without pthread support everything runs in the calling thread. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "internal.h"
+#include "meteor.h"
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+int ThreadCount = 1;
+
+#ifdef HAVE_LIBPTHREAD
+struct workqueue {
+   int count, next;
+   void (*func)(int, void *);
+   void *arg;
+   pthread_mutex_t lock;
+};
+
+static void *worker(void *arg)
+{
+   struct workqueue *queue = arg;
+   for(;;) {
+      pthread_mutex_lock(&queue->lock);
+      int i = queue->next++;
+      pthread_mutex_unlock(&queue->lock);
+
+      if(i >= queue->count)
+         break;
+      queue->func(i, queue->arg);
+   }
+   return NULL;
+}
+#endif
+
+/* call func(i, arg) for each i from 0 to count-1, possibly in parallel.
+   The order the items complete in is undefined, so func must only write
+   to data owned by item i */
+void ParallelRun(int count, void (*func)(int, void *), void *arg)
+{
+   int i;
+#ifdef HAVE_LIBPTHREAD
+   int threads = ThreadCount < count ? ThreadCount : count;
+   if(threads > 1) {
+      pthread_t thread[threads - 1];
+      struct workqueue queue = {count, 0, func, arg};
+      pthread_mutex_init(&queue.lock, NULL);
+
+      /* if a thread fails to start, the others pick up its share */
+      int started;
+      for(started = 0; started < threads - 1; started++)
+         if(pthread_create(thread + started, NULL, worker, &queue))
+            break;
+
+      worker(&queue);
+
+      for(i = 0; i < started; i++)
+         pthread_join(thread[i], NULL);
+      pthread_mutex_destroy(&queue.lock);
+      return;
+   }
+#endif
+   for(i = 0; i < count; i++)
+      func(i, arg);
+}
+
+void meteorThreads(int count)
+{
+   ThreadCount = count < 1 ? 1 : count;
+}
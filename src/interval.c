@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2007  Sean D'Epagnier   All Rights Reserved.
+ *
+ * Meteor is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * Meteor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Translate an equation given with --equation into c code which evaluates
+   it with interval arithmetic, giving a bound on the equation over a box.
+   meteor uses this to skip the parts of space the surface is not in.
+   Only the operators + - * / with parentheses, the variables x y and z,
+   numbers and a handful of math functions are understood, anything else
+   and no interval function is written. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "interval.h"
+
+/* written before the interval function, each operation gives the
+   smallest interval holding every result from its operand intervals.
+   The bounds were rounded to nearest, so they are widened by at least an
+   ulp (the gap between neighboring doubles) each way.  Constants, the box
+   and negation are exact and kept as they are, so pow still sees a whole
+   exponent, and an exact 0 is left alone, otherwise the bound of x*x at 0
+   would go negative and sqrt or log of it could no longer be bounded */
+static const char library[] =
+   "#include <math.h>\n"
+   "#include <float.h>\n"
+   "typedef struct {double lo, hi;} iv;\n"
+   "static iv I(double lo, double hi){"
+   "iv r={lo-fabs(lo)*DBL_EPSILON,hi+fabs(hi)*DBL_EPSILON};"
+   "if(isnan(r.lo)||isnan(r.hi))r.lo=-INFINITY,r.hi=INFINITY;return r;}\n"
+   "static iv iconst(double a){iv r={a,a};return r;}\n"
+   "static iv iall(void){return I(-INFINITY,INFINITY);}\n"
+   "static iv iadd(iv a,iv b){return I(a.lo+b.lo,a.hi+b.hi);}\n"
+   "static iv isub(iv a,iv b){return I(a.lo-b.hi,a.hi-b.lo);}\n"
+   "static iv ineg(iv a){iv r={-a.hi,-a.lo};return r;}\n"
+   "static iv imul(iv a,iv b){double p[4]={a.lo*b.lo,a.lo*b.hi,a.hi*b.lo,"
+   "a.hi*b.hi};iv r=I(p[0],p[0]);int i;for(i=1;i<4;i++){"
+   "if(isnan(p[i]))return iall();if(p[i]<r.lo)r.lo=p[i];"
+   "if(p[i]>r.hi)r.hi=p[i];}return I(r.lo,r.hi);}\n"
+   "static iv idiv(iv a,iv b){if(b.lo<=0&&b.hi>=0)return iall();"
+   "return imul(a,I(1/b.hi,1/b.lo));}\n"
+   "static iv ipowi(iv a,int n){if(n<0)return idiv(iconst(1),ipowi(a,-n));"
+   "double l=pow(a.lo,n),h=pow(a.hi,n);if(n%2||a.lo>=0)return I(l,h);"
+   "if(a.hi<=0)return I(h,l);return I(0,l>h?l:h);}\n"
+   "static iv iexp(iv a){return I(exp(a.lo),exp(a.hi));}\n"
+   "static iv ilog(iv a){if(a.lo<=0)return iall();"
+   "return I(log(a.lo),log(a.hi));}\n"
+   "static iv isqrt(iv a){if(a.lo<0)return iall();"
+   "return I(sqrt(a.lo),sqrt(a.hi));}\n"
+   "static iv ipow(iv a,iv b){if(b.lo==b.hi&&b.lo==floor(b.lo)"
+   "&&fabs(b.lo)<64)return ipowi(a,b.lo);"
+   "if(b.lo==b.hi&&b.lo>0&&a.lo>=0)return I(pow(a.lo,b.lo),pow(a.hi,b.lo));"
+   "if(a.lo>0)return iexp(imul(b,ilog(a)));return iall();}\n"
+   "static iv ifabs(iv a){if(a.lo>=0)return a;if(a.hi<=0)return ineg(a);"
+   "return I(0,-a.lo>a.hi?-a.lo:a.hi);}\n"
+   "static iv isin(iv a){if(!(a.hi-a.lo<2*M_PI))return I(-1,1);"
+   "double l=sin(a.lo),h=sin(a.hi);iv r=I(l<h?l:h,l<h?h:l);"
+   "if(M_PI/2+2*M_PI*ceil((a.lo-M_PI/2)/(2*M_PI))<=a.hi)r.hi=1;"
+   "if(-M_PI/2+2*M_PI*ceil((a.lo+M_PI/2)/(2*M_PI))<=a.hi)r.lo=-1;"
+   "return r;}\n"
+   "static iv icos(iv a){return isin(iadd(a,iconst(M_PI/2)));}\n";
+
+/* the functions understood, and how many arguments they take */
+static const struct {
+   const char *name;
+   int args;
+} functions[] = {
+   {"sqrt", 1}, {"exp", 1}, {"log", 1}, {"fabs", 1},
+   {"sin", 1}, {"cos", 1}, {"pow", 2}};
+
+static const char *pos;
+static int failed;
+
+/* whether the expression just parsed has an integer type in c */
+static int integer;
+
+/* format a new string, freeing the arguments a and b */
+static char *join(const char *fmt, char *a, char *b)
+{
+   int len = snprintf(NULL, 0, fmt, a, b);
+   char *s = malloc(len + 1);
+   sprintf(s, fmt, a, b);
+   free(a);
+   free(b);
+   return s;
+}
+
+static void skipspace(void)
+{
+   while(isspace(*pos))
+      pos++;
+}
+
+/* the next character must be c */
+static void expect(char c)
+{
+   skipspace();
+   if(*pos == c)
+      pos++;
+   else
+      failed = 1;
+}
+
+static char *expression(void);
+
+static char *primary(void)
+{
+   skipspace();
+
+   if(*pos == '(') {
+      pos++;
+      char *e = expression();
+      expect(')');
+      return e;
+   }
+
+   integer = 0;
+   if(isdigit(*pos) || *pos == '.') {
+      char *end;
+      strtod(pos, &end);
+      char *num = strndup(pos, end - pos);
+      pos = end;
+      if(num[0] == '0' && (num[1] == 'x' || num[1] == 'X'))
+         integer = !strpbrk(num, ".pP");
+      else
+         integer = !strpbrk(num, ".eE");
+      return join("iconst(%s)", num, NULL);
+   }
+
+   if(isalpha(*pos) || *pos == '_') {
+      const char *start = pos;
+      while(isalnum(*pos) || *pos == '_')
+         pos++;
+      char *name = strndup(start, pos - start);
+
+      if(!strcmp(name, "x") || !strcmp(name, "y") || !strcmp(name, "z")) {
+         name[0] = toupper(name[0]);
+         return name;
+      }
+
+      if(!strcmp(name, "M_PI") || !strcmp(name, "M_E"))
+         return join("iconst(%s)", name, NULL);
+
+      skipspace();
+      int i;
+      for(i = 0; i < sizeof functions / sizeof *functions; i++)
+         if(!strcmp(name, functions[i].name) && *pos == '(') {
+            pos++;
+            char *args = expression();
+            if(functions[i].args == 2) {
+               expect(',');
+               args = join("%s,%s", args, expression());
+            }
+            expect(')');
+            integer = 0;
+            return join("i%s(%s)", name, args);
+         }
+      free(name);
+   }
+
+   failed = 1;
+   return strdup("");
+}
+
+static char *unary(void)
+{
+   skipspace();
+   if(*pos == '-') {
+      pos++;
+      return join("ineg(%s)", unary(), NULL);
+   }
+   if(*pos == '+') {
+      pos++;
+      return unary();
+   }
+   return primary();
+}
+
+static char *term(void)
+{
+   char *t = unary();
+   int tint = integer;
+   for(;;) {
+      skipspace();
+      if(*pos == '*') {
+         pos++;
+         t = join("imul(%s,%s)", t, unary());
+         tint = tint && integer;
+      } else if(*pos == '/') {
+         pos++;
+         char *u = unary();
+         /* c divides integers differently, leave those alone */
+         if(tint && integer)
+            failed = 1;
+         t = join("idiv(%s,%s)", t, u);
+         tint = 0;
+      } else {
+         integer = tint;
+         return t;
+      }
+   }
+}
+
+static char *expression(void)
+{
+   char *e = term();
+   int eint = integer;
+   for(;;) {
+      skipspace();
+      if(*pos == '+') {
+         pos++;
+         e = join("iadd(%s,%s)", e, term());
+         eint = eint && integer;
+      } else if(*pos == '-') {
+         pos++;
+         e = join("isub(%s,%s)", e, term());
+         eint = eint && integer;
+      } else {
+         integer = eint;
+         return e;
+      }
+   }
+}
+
+int writeintervalfunc(FILE *file, const char *equation)
+{
+   pos = equation;
+   failed = 0;
+
+   char *e = expression();
+   skipspace();
+   if(*pos)
+      failed = 1;
+
+   if(!failed) {
+      fputs(library, file);
+      fprintf(file, "void interval(double r[2], double min[3], double max[3])"
+              "{iv X={min[0],max[0]},Y={min[1],max[1]},Z={min[2],max[2]};"
+              "iv v=%s;r[0]=v.lo;r[1]=v.hi;}\n", e);
+   }
+
+   free(e);
+   return !failed;
+}
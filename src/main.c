@@ -34,6 +34,7 @@
 #include "config.h"
 #include "util.h"
 #include "opengl.h"
+#include "interval.h"
 
 #include "meteor.h"
 
@@ -54,10 +55,43 @@ static double (*clipfunc)(double, double, double);
 static int num_triangles = -1, max_num_triangles = -1;
 static double percent_triangles = -1;
 
+static int threads = 1, lazydata;
+
+/* if set, merge in rounds with meteorMergeParallel */
+static double batchtolerance = -1;
+
+/* stop merging once merges cost more than maxerror, or after mergetime
+   seconds */
+static double maxerror = -1, mergetime;
+
+/* with --stream the mesh is written to the output file while building,
+   the triangles wait in a temporary file if they have to go after the
+   points, and the counts in the header are filled in at the end */
+static int streaming, streampoints, streamtriangles;
+static FILE *streamtrianglefile;
+static long streamheader;
+
+/* points to follow the surface from instead of scanning */
+static double *seeds;
+static int seedcount;
+
 static int propagation;
+static double propagatetolerance;
 static double meteoraggregation = -1;
+static int cluster;
+static double cellsize;
 
 static double (*func)(double, double, double);
+static void (*funcbatch)(double *, const double *, const double *,
+                         const double *, int);
+static void (*interval)(double[2], double[3], double[3]);
+static void (*gradient)(double[3], double[3]);
+
+static int refinemethod = METEOR_REFINE_REGULA_FALSI, refineiterations = 5;
+static double refinetolerance;
+static double lipschitz;
+static int polygonizer = METEOR_TETRAHEDRA;
+static int storage = METEOR_DOUBLE;
 
 static int input_fileformat = -1; /* autodetect */
 static int output_fileformat = METEOR_FILE_FORMAT_TEXT;
@@ -79,10 +113,9 @@ static void defaultnormal(double n[3], double p[3])
 
 static void maxTriangles(int cur)
 {
-   if(max_num_triangles != -1)
-      while(meteorTriangleMergeableCount() > max_num_triangles * (cur + 1))
-         if(!meteorMerge())
-            break;
+   if(max_num_triangles != -1
+      && meteorTriangleMergeableCount() > max_num_triangles * (cur + 1))
+      meteorMergeTo(max_num_triangles * (cur + 1), -1, 0);
 }
 
 static int builtpoints, builttriangles;
@@ -113,20 +146,29 @@ static void build(void)
             verbose_printf("\b");
       }
    }
-   maxTriangles(0);
 
  skiploop:
+   maxTriangles(0);
    verbose_printf("%f seconds\n", getdtime() - time);
+   verbose_printf("%.2f evaluations per edge\n", meteorRefineIterations());
    builtpoints = meteorPointCount();
    builttriangles = meteorTriangleCount();
 }
 
+static int mergeprogress(int triangles)
+{
+   verbose_printf("merging triangles: %d \r", triangles);
+   return 0;
+}
+
 static void merge(void)
 {
    /* option not specified */
    if(num_triangles == -1)
       if(percent_triangles != -1)
          num_triangles = percent_triangles / 100.0 * meteorTriangleCount();
+      else if(maxerror >= 0 || mergetime > 0)
+         num_triangles = 0;
       else
          return;
 
@@ -136,17 +178,53 @@ static void merge(void)
       return;
 
    double time = getdtime();
+
+   /* a progressive mesh was loaded, take out the level instead of merging */
+   if(meteorProgressiveSize(NULL, NULL)) {
+      int level = meteorProgressiveLevel(num_triangles);
+      if(level == -1)
+         warning("%s\n", meteorError());
+      else
+         verbose_printf("progressive mesh level %d: %f seconds\n",
+                        level, getdtime() - time);
+      return;
+   }
+
+   if(output_fileformat == METEOR_FILE_FORMAT_PROGRESSIVE)
+      meteorProgressive(1);
    int triangles;
-   int c, update = (count - num_triangles) / 500 + 1;
+   int update = (count - num_triangles) / 500 + 1;
+
+   if(batchtolerance >= 0) {
+      if(maxerror >= 0 || mergetime > 0)
+         warning("--max-error and --merge-time are ignored "
+                 "with --batch-tolerance\n");
+
+      /* stop every so often to show progress */
+      while((triangles=meteorTriangleCount()) > num_triangles) {
+         verbose_printf("merging triangles: %d \r", triangles);
+         int target = triangles - 100 * update;
+         if(target < num_triangles)
+            target = num_triangles;
+         if(!meteorMergeParallel(target, batchtolerance)) {
+            warning("failed to merge additional points\n");
+            break;
+         }
+      }
+      verbose_printf("merging triangles: %f seconds\n", getdtime() - time);
+      return;
+   }
 
-   while((triangles=meteorTriangleCount()) > num_triangles) {
-      if(c++%update==0 || triangles-1 == num_triangles)
-         verbose_printf("merging triangles: %d \r", triangles - 1);
-      
-      if(!meteorMerge()) {
+   meteorMergeProgress(mergeprogress, update);
+   meteorMergeTo(num_triangles, maxerror, mergetime);
+   meteorMergeProgress(NULL, 0);
+
+   triangles = meteorTriangleCount();
+   if(triangles > num_triangles) {
+      if(maxerror < 0 && mergetime <= 0)
          warning("failed to merge additional points\n");
-         break;
-      }
+      else
+         verbose_printf("merging stopped at %d triangles\n", triangles);
    }
 
    verbose_printf("merging triangles: %f seconds\n", getdtime() - time);   
@@ -164,18 +242,30 @@ static void propagate(void)
 
    verbose_printf("propagating points, %d iterations... ", propagation);
    double time = getdtime();
+   meteorPropagateTolerance(propagatetolerance);
    double improvement = meteorPropagate(propagation);
-   verbose_printf("%f seconds, improvement: %f%%\n",
-                  getdtime() - time, 100.0*improvement);
+   double evaluations, converged;
+   meteorPropagateStats(&evaluations, &converged);
+   verbose_printf("%f seconds, improvement: %f%%\n"
+                  "%.2f evaluations per point, %.2f%% converged\n",
+                  getdtime() - time, 100.0*improvement,
+                  evaluations, 100.0*converged);
 }
 
 static void aggregate(void)
 {
-   if(meteoraggregation == -1)
+   if(meteoraggregation == -1 && !cellsize)
       return;
 
    double time = getdtime();
 
+   if(cluster) {
+      meteorCluster(meteoraggregation, cellsize);
+      verbose_printf("clustering points: %d points, %f seconds\n",
+                     meteorPointCount(), getdtime() - time);
+      return;
+   }
+
    int points;
    int i;
 
@@ -244,6 +334,12 @@ static void correcttexturecoords(void)
 
 static void transformmeteor(void)
 {
+   if(output_fileformat == METEOR_FILE_FORMAT_PROGRESSIVE
+      && (propagation || clipfunc || correcttexcoords || Rotation[0]
+          || Translation[0] || Translation[1] || Translation[2]
+          || Scale[0] != 1 || Scale[1] != 1 || Scale[2] != 1))
+      warning("the progressive format only keeps the merges\n");
+
    merge();
    aggregate();
    propagate();
@@ -280,7 +376,8 @@ static struct {
 } formattable[] = {{METEOR_FILE_FORMAT_TEXT, "text"},
                    {METEOR_FILE_FORMAT_BINARY, "binary"},
                    {METEOR_FILE_FORMAT_WAVEFRONT, "wavefront"},
-                   {METEOR_FILE_FORMAT_VIDEOSCAPE, "videoscape"}};
+                   {METEOR_FILE_FORMAT_VIDEOSCAPE, "videoscape"},
+                   {METEOR_FILE_FORMAT_PROGRESSIVE, "progressive"}};
 
 static const int formattablelen = (sizeof formattable) / (sizeof *formattable);
 static void load(void)
@@ -307,6 +404,152 @@ static void load(void)
    verbose_printf("%f seconds\n", getdtime() - time);   
 }
 
+#define TEXT_PRECISION "%.7g"
+#define TEXT_PRECISION3 TEXT_PRECISION" "TEXT_PRECISION" "TEXT_PRECISION
+
+static void streamsink(const double *points, int pointcount,
+                       const int *triangles, int trianglecount)
+{
+   int format = meteorFormat();
+   int dataparts = !!(format&METEOR_NORMALS) + !!(format&METEOR_COLORS)
+      + !!(format&METEOR_TEXCOORDS);
+   int size = 3 * (dataparts + 1), i, j;
+
+   switch(output_fileformat) {
+   case METEOR_FILE_FORMAT_TEXT:
+      for(i = 0; i < pointcount; i++) {
+         const double *d = points + i * size;
+         for(j = 0; j < size; j += 3)
+            fprintf(outputfile, j ? " "TEXT_PRECISION3 : TEXT_PRECISION3,
+                    d[j], d[j+1], d[j+2]);
+         fputc('\n', outputfile);
+      }
+      for(i = 0; i < 3 * trianglecount; i += 3)
+         fprintf(streamtrianglefile, "%d %d %d\n",
+                 triangles[i], triangles[i+1], triangles[i+2]);
+      break;
+   case METEOR_FILE_FORMAT_BINARY:
+      fwrite(points, size * sizeof *points, pointcount, outputfile);
+      fwrite(triangles, 3 * sizeof *triangles, trianglecount,
+             streamtrianglefile);
+      break;
+   case METEOR_FILE_FORMAT_WAVEFRONT:
+      /* faces can come between vertices, so nothing waits */
+      for(i = 0; i < pointcount; i++) {
+         const double *d = points + i * size + 3;
+         fprintf(outputfile, "v "TEXT_PRECISION3"\n", d[-3], d[-2], d[-1]);
+         if(format & METEOR_NORMALS)
+            fprintf(outputfile, "vn "TEXT_PRECISION3"\n", d[0], d[1], d[2]),
+               d += 3;
+         if(format & METEOR_COLORS)
+            d += 3;
+         if(format & METEOR_TEXCOORDS)
+            fprintf(outputfile, "vt "TEXT_PRECISION3"\n", d[0], d[1], d[2]);
+      }
+      for(i = 0; i < 3 * trianglecount; i += 3) {
+         fputc('f', outputfile);
+         for(j = 0; j < 3; j++) {
+            int n = triangles[i+j] + 1;
+            if(format & METEOR_NORMALS)
+               if(format & METEOR_TEXCOORDS)
+                  fprintf(outputfile, " %d/%d/%d", n, n, n);
+               else
+                  fprintf(outputfile, " %d//%d", n, n);
+            else if(format & METEOR_TEXCOORDS)
+               fprintf(outputfile, " %d/%d", n, n);
+            else
+               fprintf(outputfile, " %d", n);
+         }
+         fputc('\n', outputfile);
+      }
+      break;
+   }
+
+   streampoints += pointcount;
+   streamtriangles += trianglecount;
+}
+
+static void writestreamheader(void)
+{
+   int format = meteorFormat();
+   switch(output_fileformat) {
+   case METEOR_FILE_FORMAT_TEXT:
+      /* wide enough to fill in the counts later */
+      fprintf(outputfile, "%d %10d %10d\n", format,
+              streampoints, streamtriangles);
+      break;
+   case METEOR_FILE_FORMAT_BINARY:
+      fwrite(&format, sizeof format, 1, outputfile);
+      fwrite(&streampoints, sizeof streampoints, 1, outputfile);
+      fwrite(&streamtriangles, sizeof streamtriangles, 1, outputfile);
+      break;
+   }
+}
+
+static void startstream(void)
+{
+   if(!outputfile)
+      die("--stream needs an output file, try --create\n");
+   if(animated)
+      die("--stream can't be used with --animate\n");
+   if(max_num_triangles != -1 || num_triangles != -1 || percent_triangles != -1
+      || maxerror >= 0 || mergetime > 0 || meteoraggregation != -1 || cluster
+      || propagation || clipfunc || correcttexcoords || Rotation[0]
+      || Translation[0] || Translation[1] || Translation[2]
+      || Scale[0] != 1 || Scale[1] != 1 || Scale[2] != 1)
+      warning("--stream writes the mesh as it is built, "
+              "so it can't be simplified, clipped or transformed\n");
+   max_num_triangles = -1;
+   Rotation[0] = Translation[0] = Translation[1] = Translation[2] = 0;
+   Scale[0] = Scale[1] = Scale[2] = 1;
+
+   switch(output_fileformat) {
+   case METEOR_FILE_FORMAT_TEXT:
+   case METEOR_FILE_FORMAT_BINARY:
+      if((streamheader = ftell(outputfile)) == -1)
+         die("--stream can only write the %s format to a regular file, "
+             "wavefront can go anywhere\n",
+             output_fileformat == METEOR_FILE_FORMAT_TEXT ? "text" : "binary");
+      if(!(streamtrianglefile = tmpfile()))
+         die("failed to create temporary file: %s\n", strerror(errno));
+      writestreamheader();
+      break;
+   case METEOR_FILE_FORMAT_WAVEFRONT:
+      break;
+   default:
+      die("--stream can't write this output format\n");
+   }
+
+   streampoints = streamtriangles = 0;
+   meteorStream(streamsink);
+}
+
+static void finishstream(void)
+{
+   double time = getdtime();
+   verbose_printf("finishing stream... ");
+
+   if(streamtrianglefile) {
+      char buffer[65536];
+      size_t len;
+      rewind(streamtrianglefile);
+      while((len = fread(buffer, 1, sizeof buffer, streamtrianglefile)))
+         fwrite(buffer, 1, len, outputfile);
+      fclose(streamtrianglefile);
+      streamtrianglefile = NULL;
+
+      fseek(outputfile, streamheader, SEEK_SET);
+      writestreamheader();
+      fseek(outputfile, 0, SEEK_END);
+   }
+
+   if(ferror(outputfile))
+      warning("failed writing stream: %s\n", strerror(errno));
+   else
+      verbose_printf("%d points %d triangles %f seconds\n",
+                     streampoints, streamtriangles, getdtime() - time);
+}
+
 static int save(void)
 {
    double time = getdtime();
@@ -393,8 +636,8 @@ void *compileandload(const char *sourcefilename, const char *name)
    case -1:
       die("fork failed\n");
    case 0:
-      execlp("gcc", "gcc", "-shared", "-O", "-xc", "-fPIC", "-lm", "-o",
-             filename, sourcefilename, NULL);
+      execlp("gcc", "gcc", "-shared", "-O2", "-ftree-vectorize", "-xc",
+             "-fPIC", "-lm", "-o", filename, sourcefilename, NULL);
       die("exec failed\n");
    }
 
@@ -415,7 +658,10 @@ void *compileandload(const char *sourcefilename, const char *name)
    return handle;
 }
 
-void *makeequationfunc(const char *equation)
+/* compile equation, if batch is not NULL it is set to a version of the
+   function which evaluates arrays of points, and if bound is not NULL it is
+   set to an interval arithmetic version (or NULL if that isn't possible) */
+void *makeequationfunc(const char *equation, void **batch, void **bound)
 {
    char filename[] = "/tmp/meteorcXXXXXX";
    int fd;
@@ -435,10 +681,20 @@ void *makeequationfunc(const char *equation)
 
    fprintf(file, "#include <math.h>\ndouble func(double x, double y, "
            "double z){return (%s);}\n", equation);
+   fprintf(file, "void funcbatch(double *v, const double *xs, const double *ys, "
+           "const double *zs, int n){int i; for(i=0; i<n; i++) {double x=xs[i], "
+           "y=ys[i], z=zs[i]; v[i]=(%s);}}\n", equation);
+   if(bound && !writeintervalfunc(file, equation))
+      verbose_printf("no interval arithmetic for %s, "
+                     "evaluating everywhere\n", name);
    fclose(file);
 
    void *handle = compileandload(filename, name);
    unlink(filename);
+   if(batch)
+      *batch = lt_dlsym(handle, "funcbatch");
+   if(bound)
+      *bound = lt_dlsym(handle, "interval");
    return lt_dlsym(handle, "func");
 }
 #endif
@@ -466,15 +722,41 @@ static void usage(void)
   "    --max-frames [NUM] abort after num frames have been generated\n"
   "    --max-triangles [NUM] max number of triangles to allow while building\n"
   "                    (saves ram).\n"
+  "    --threads [NUM] number of threads to use while building, and merging"
+  "\n\twith --batch-tolerance\n"
+  "    --lipschitz [NUM] the function changes by at most NUM per unit distance"
+  "\n\tso space far from the surface can be skipped while building\n"
+  "    --lazy-data only calculate normals, colors and texcoords for the "
+  "points\n\tleft after simplifying\n"
+  "    --refine method[,iters[,tolerance]]  how to find where the surface "
+  "crosses\n\tedges, method is regula-falsi (default) or illinois\n"
+  "    --polygonizer [NAME] tetrahedra (default), marching-cubes or "
+  "surface-nets,\n\tthe last two make fewer triangles for the same step\n"
+  "    --stream  write the mesh to the output file while building so only the "
+  "part\n\tbeing built is kept in memory, nothing can be done to it after\n"
+  "    --storage [TYPE] double (default) or float, float halves the memory "
+  "used\n\tfor positions and data, calculations are still done in double\n"
+  "    --seed x,y,z  follow the surface from near this point instead of "
+  "scanning\n\tthe whole range, may be given more than once\n"
   "\nSimplification Options:\n"
   "-t, --triangles [NUM] or [NUM%] merge edges attempting to have NUM"
   " triangles\n\tremaining\n"
+  "    --batch-tolerance [FRACTION] merge many edges at once across threads, "
+  "each\n\tround looks at this fraction of the cheapest merges, try .01\n"
+  "    --max-error [NUM] stop merging before a merge whose quadric error is "
+  "more\n\tthan NUM, merges as far as that goes if -t is not given\n"
+  "    --merge-time [SECONDS] stop merging after this long\n"
   "-j, --aggregation [NUM] perform aggregation on the mesh until there are not "
   "more\n       than NUM points remaining\n"
+  "    --cluster  aggregate by merging the points in each cell of a grid in "
+  "one\n\tpass, much faster than merging the closest points one at a time\n"
+  "    --cell-size [SIZE] cluster with cells of this size instead of sizing "
+  "them\n\tfor --aggregation\n"
   "    --clip [EQUATION] clip the mesh by this equation\n"
   "    --correct-texcoords generate multiple points in the same location with"
   "\n\tcorrecting texture mapping errors\n"
-  "-r, --propagate [ITERS] move points toward input function after generation\n"
+  "-r, --propagate ITERS[,TOLERANCE] move points toward input function after"
+  "\n\tgeneration, each stops once the function is within TOLERANCE\n"
   "\nTransformation Options:\n"
   "    --rotate angle,x,y,z  Rotate all points and normals by angle in "
   "degrees \n         around the vector <x,y,z>\n"
@@ -552,6 +834,59 @@ static void getscale(void)
       die("invalid scale: %s\n", optarg);
 }
 
+static void addseed(void)
+{
+   seeds = realloc(seeds, 3 * (seedcount + 1) * sizeof *seeds);
+   double *s = seeds + 3 * seedcount;
+   if(sscanf(optarg, "%lf,%lf,%lf", s+0, s+1, s+2) != 3)
+      die("invalid seed: %s\n", optarg);
+   seedcount++;
+}
+
+static void getrefine(void)
+{
+   char method[32];
+   if(sscanf(optarg, "%31[^,],%d,%lf", method,
+             &refineiterations, &refinetolerance) < 1)
+      die("invalid refinement: %s\n", optarg);
+
+   if(!strcmp(method, "regula-falsi"))
+      refinemethod = METEOR_REFINE_REGULA_FALSI;
+   else if(!strcmp(method, "illinois"))
+      refinemethod = METEOR_REFINE_ILLINOIS;
+   else
+      die("invalid refinement method: %s\n", method);
+}
+
+static void getpropagate(void)
+{
+   if(sscanf(optarg, "%d,%lf", &propagation, &propagatetolerance) < 1
+      || propagatetolerance < 0)
+      die("invalid propagation: %s\n", optarg);
+}
+
+static void getpolygonizer(void)
+{
+   if(!strcmp(optarg, "tetrahedra"))
+      polygonizer = METEOR_TETRAHEDRA;
+   else if(!strcmp(optarg, "marching-cubes"))
+      polygonizer = METEOR_MARCHING_CUBES;
+   else if(!strcmp(optarg, "surface-nets"))
+      polygonizer = METEOR_SURFACE_NETS;
+   else
+      die("invalid polygonizer: %s\n", optarg);
+}
+
+static void getstorage(void)
+{
+   if(!strcmp(optarg, "float"))
+      storage = METEOR_FLOAT;
+   else if(!strcmp(optarg, "double"))
+      storage = METEOR_DOUBLE;
+   else
+      die("invalid storage: %s\n", optarg);
+}
+
 static double optdouble(const char *arg)
 {
    char *endptr;
@@ -620,10 +955,23 @@ static struct option longopts[] = {
    {"step", 1, 0, 's'},
    {"max-frames", 1, 0, 4},
    {"max-triangles", 1, 0, 15},
+   {"threads", 1, 0, 16},
+   {"lipschitz", 1, 0, 17},
+   {"seed", 1, 0, 18},
+   {"lazy-data", 0, 0, 19},
+   {"refine", 1, 0, 20},
+   {"polygonizer", 1, 0, 21},
+   {"stream", 0, 0, 22},
+   {"storage", 1, 0, 23},
    /* simplification options */
    {"triangles", 1, 0, 't'},
+   {"batch-tolerance", 1, 0, 24},
+   {"max-error", 1, 0, 25},
+   {"merge-time", 1, 0, 26},
    {"propagate", 1, 0, 'r'},
    {"aggregation", 1, 0, 'j'},
+   {"cluster", 0, 0, 27},
+   {"cell-size", 1, 0, 28},
    {"clip", 1, 0, 5},
    {"correct-texcoords", 0, 0, 6},
     /* transformation options */
@@ -686,10 +1034,23 @@ int main(int argc, char** argv)
       case 'z': setminmaxarg(&minz, &maxz); break;
       case 4: animationmaxframes = optdouble("max-frames"); break;
       case 15: max_num_triangles = optdouble("max-triangles"); break;
+      case 16: threads = optdouble("threads"); break;
+      case 17: lipschitz = optdouble("lipschitz"); break;
+      case 18: addseed(); break;
+      case 19: lazydata = 1; break;
+      case 20: getrefine(); break;
+      case 21: getpolygonizer(); break;
+      case 22: streaming = 1; break;
+      case 23: getstorage(); break;
          /* simplification options */
       case 't': opttriangles(); break;
-      case 'r': propagation = optdouble("propagation"); break;
+      case 24: batchtolerance = optdouble("batch-tolerance"); break;
+      case 25: maxerror = optdouble("max-error"); break;
+      case 26: mergetime = optdouble("merge-time"); break;
+      case 'r': getpropagate(); break;
       case 'j': meteoraggregation = optdouble("aggregation"); break;
+      case 27: cluster = 1; break;
+      case 28: cellsize = optdouble("cell-size"), cluster = 1; break;
       case 5: strncpy(clipequation, optarg, PATH_MAX); break;
       case 6: correcttexcoords = 1; break;
          /* transformation options */
@@ -710,6 +1071,10 @@ int main(int argc, char** argv)
 
    nomoreargs:
 
+   /* before anything is loaded */
+   meteorStorage(storage);
+   meteorThreads(threads);
+
    /* send verbose messages to stderr */
    if(osmesafilename[0] && !strcmp(osmesafilename, "-") && verbose) 
       verbose = 2;
@@ -755,7 +1120,7 @@ int main(int argc, char** argv)
 
    /* compile and load the clipping equation if specified */
    if(clipequation[0])
-      *(void **)(&clipfunc) = makeequationfunc(clipequation);
+      *(void **)(&clipfunc) = makeequationfunc(clipequation, NULL, NULL);
 
    if(inputfilename[0]) {
       if(equation[0])
@@ -766,7 +1131,8 @@ int main(int argc, char** argv)
    }
 
    if(equation[0])
-      *(void **)(&func) = makeequationfunc(equation);
+      *(void **)(&func) = makeequationfunc(equation, (void **)&funcbatch,
+                                          (void **)&interval);
 
    /* now load the input source */
    char *sourcefilename = argv[optind];
@@ -790,9 +1156,15 @@ int main(int argc, char** argv)
          warning("--equation specified and 'func' exits in source file, "
                  "using source file\n");
    } else
-      if(func2)
+      if(func2) {
          *(void **)(&func) = func2;
-      else
+         /* look for the optional batch version of func */
+         *(void **)(&funcbatch) = lt_dlsym(handle, "funcbatch");
+         /* and a bound on it used to skip empty space */
+         *(void **)(&interval) = lt_dlsym(handle, "interval");
+         /* and its gradient for newton steps */
+         *(void **)(&gradient) = lt_dlsym(handle, "gradient");
+      } else
          die("Could not find 'func' in input file\n");
 
    /* look for the normal function */
@@ -816,6 +1188,17 @@ int main(int argc, char** argv)
  noinputsource:
 
    meteorFunc(func);
+   if(funcbatch)
+      meteorFuncBatch(funcbatch);
+
+   meteorGradientFunc(gradient);
+   meteorRefine(refinemethod, refineiterations, refinetolerance);
+   meteorPolygonizer(polygonizer);
+
+   if(lipschitz > 0)
+      meteorLipschitz(lipschitz);
+   else
+      meteorIntervalFunc(interval);
 
    if(normal)
       meteorNormalFunc(normal);
@@ -828,12 +1211,17 @@ int main(int argc, char** argv)
    meteorTexCoordFunc(texcoord);
    meteorColorFunc(color);
 
+   meteorSeeds(seeds, seedcount);
+   meteorLazyData(lazydata);
+
    /* set up the meteor for generation */
    meteorSetSize(minx, maxx, miny, maxy, minz, maxz, step);
 
    int format = (!!normals)*METEOR_NORMALS | (!!color)*METEOR_COLORS
       | (!!texcoord)*METEOR_TEXCOORDS;
    meteorReset(format);
+   if(streaming)
+      startstream();
    build();
 
    /* warn about potentially invalid combinations */
@@ -845,11 +1233,20 @@ int main(int argc, char** argv)
 
    if(inputfile && max_num_triangles != -1)
       warning("--max-triangles only useful when generating a meteor\n");
+   if(inputfile && streaming) {
+      warning("--stream only useful when generating a meteor\n");
+      streaming = 0;
+   }
 
-   transformmeteor();
+   /* a streamed mesh has already been written and the one left is empty */
+   if(!streaming)
+      transformmeteor();
 
    if(outputfile) {
-      save();
+      if(streaming)
+         finishstream();
+      else
+         save();
       if(!animated && outputfile != stdout)
          fclose(outputfile);
    }
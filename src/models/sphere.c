@@ -13,6 +13,21 @@ double func(double x, double y, double z)
 {
    return (x*x + y*y + z*z) - .2;
 }
+
+/* bound func over a box so the empty space can be skipped */
+void interval(double r[2], double min[3], double max[3])
+{
+   double near = 0, far = 0;
+   int i;
+   for(i = 0; i < 3; i++) {
+      double a = min[i]*min[i], b = max[i]*max[i];
+      if(min[i] > 0 || max[i] < 0)
+         near += a < b ? a : b;
+      far += a > b ? a : b;
+   }
+   r[0] = near - .2;
+   r[1] = far - .2;
+}
 #if 0
 void texcoord(double c[3], double p[3])
 {
@@ -126,7 +126,7 @@ void keypress(unsigned char key)
    static int c, w, f, one, i;
    switch(key) {
    case 'm':
-      if(!meteorMerge())
+      if(!meteorMergeTo(meteorTriangleCount() - 1, -1, 0))
          warning("cannot reduce meteor further\n");
       rebuild = 1;
       break;